@@ -0,0 +1,86 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#include <glm/gtc/matrix_transform.hpp>
+#include <GLFW/glfw3.h>
+#include "Bot.h"
+
+//~~~
+// Bot
+//~~~
+void Bot::set_waypoints(const std::vector<glm::vec3>& waypoints, size_t first)
+{
+	m_waypoints = waypoints;
+	m_next = m_waypoints.empty() ? 0 : first % m_waypoints.size();
+}
+
+void Bot::set_loop(const glm::mat4& trans, float radius, int n)
+{	// the heading and the left of the vehicle on the ground
+	glm::vec3 pos = glm::vec3(trans[3]);
+	glm::vec3 forward = glm::vec3(trans[2].x, 0.f, trans[2].z);
+	forward = glm::length(forward) > 0.f ? glm::normalize(forward) : glm::vec3(0.f, 0.f, 1.f);
+	glm::vec3 left = glm::vec3(forward.z, 0.f, -forward.x);
+	// the center is on the left so the vehicle starts on the loop
+	glm::vec3 center = pos + left * radius;
+	std::vector<glm::vec3> waypoints;
+	for (int i = 1; i <= n; i++) {
+		float angle = glm::radians(360.f * i / n);
+		waypoints.push_back(center + radius * (forward * glm::sin(angle) - left * glm::cos(angle)));
+	}
+	set_waypoints(waypoints);
+}
+
+void Bot::drive(const glm::mat4& trans, float elapsed_time, Controller& ctlr)
+{
+	ctlr.m_keyboard.clear();
+	ctlr.m_mouse.clear();
+	ctlr.m_scroll_pos = glm::vec2(0.f, 0.f);
+	if (m_waypoints.empty()) return;
+
+	glm::vec3 pos = glm::vec3(trans[3]);
+	glm::vec3 to_next = m_waypoints[m_next] - pos;
+	to_next.y = 0.f;
+	if (glm::length(to_next) < m_arrival_distance) {
+		m_next = (m_next + 1) % m_waypoints.size();
+	}
+
+	// the direction to the waypoint in the vehicle frame
+	glm::vec3 target = glm::vec3(glm::inverse(trans) * glm::vec4(m_waypoints[m_next], 1.f));
+	float angle = glm::degrees(glm::atan(target.x, target.z));
+	if (angle > 10.f) ctlr.m_keyboard.insert(GLFW_KEY_LEFT);
+	else if (angle < -10.f) ctlr.m_keyboard.insert(GLFW_KEY_RIGHT);
+	else ctlr.m_keyboard.insert(GLFW_KEY_END); // straighten the wheels
+	// a tank turns in place when the waypoint is behind, the others keep
+	// going and turn around
+	if (!m_can_pivot || glm::abs(angle) < 90.f) ctlr.m_keyboard.insert(GLFW_KEY_UP);
+
+	if (m_fire_interval > 0.f) {
+		m_since_fire += elapsed_time;
+		if (m_since_fire >= m_fire_interval) {
+			ctlr.m_mouse.insert(GLFW_MOUSE_BUTTON_LEFT);
+			m_since_fire = 0.f;
+		}
+	}
+}
+
+//~~~
+// BotPlayer
+//~~~
+void BotPlayer::set_player_transform(int which, const glm::mat4& trans)
+{
+	if (which != 0) return;
+	m_player_trans = trans;
+	if (!m_placed) {
+		m_placed = true;
+		if (!m_bot.has_waypoints()) m_bot.set_loop(trans, 30.f);
+	}
+}
+
+bool BotPlayer::end_update(float elapsed_time)
+{	// the inputs for the next step
+	if (m_placed) m_bot.drive(m_player_trans, elapsed_time, m_controller);
+	return true;
+}
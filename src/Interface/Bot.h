@@ -0,0 +1,72 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#pragma once
+
+#include <vector>
+#include <glm/glm.hpp>
+#include "Renderer.h"
+#include "Controller.h"
+
+// Drives a vehicle through a loop of waypoints by pressing the keys a player
+// would press, it knows nothing but the vehicle transform so it works the same
+// on the server and in a client.
+class Bot
+{
+protected:
+	std::vector<glm::vec3> m_waypoints; // in world frame
+	size_t m_next;
+	float m_arrival_distance;
+	float m_fire_interval;	// seconds of real time, 0 to hold fire
+	float m_since_fire;
+	bool m_can_pivot; // turns in place, only tanks do
+
+public:
+	Bot(float fire_interval = 2.f, bool can_pivot = false) : m_next(0), m_arrival_distance(5.f),
+		m_fire_interval(fire_interval), m_since_fire(0.f), m_can_pivot(can_pivot) {}
+
+	// the bot heads to the waypoint first
+	void set_waypoints(const std::vector<glm::vec3>& waypoints, size_t first = 0);
+	// a loop of n waypoints that starts ahead of the vehicle at trans, tangent
+	// to its heading, and turns left
+	void set_loop(const glm::mat4& trans, float radius, int n = 8);
+	bool has_waypoints() const { return !m_waypoints.empty(); }
+
+	// fills the controller with the inputs for the vehicle at trans, the
+	// vehicle moves forward along +z and its left is +x, elapsed_time is in
+	// seconds of real time
+	void drive(const glm::mat4& trans, float elapsed_time, Controller& ctlr);
+};
+
+// A player without a window, the inputs come from a bot that loops around
+// where the player vehicle starts. Everything else sent to it is dropped.
+class BotPlayer : public Renderer
+{
+protected:
+	Bot m_bot;
+	Controller m_controller;
+	glm::mat4 m_player_trans;
+	bool m_placed; // the player transform is known
+
+public:
+	BotPlayer(float fire_interval = 2.f) : m_bot(fire_interval), m_player_trans(1.f), m_placed(false) {}
+	virtual ~BotPlayer() {}
+
+	virtual int how_many_controllers() { return 1; }
+	virtual Controller& get_controller(int which) { return m_controller; }
+	virtual void set_player_transform(int which, const glm::mat4& trans);
+	virtual void setup_camera(bool follow, const glm::vec3& eye, const glm::vec3& target) {}
+
+	virtual void add_template(int id, const char* desc, size_t size) {}
+	virtual void add_shape(int id, int template_id, const glm::mat4& trans) {}
+	virtual void update_shape(int id, const glm::mat4& trans) {}
+	virtual void remove_shape(int id) {}
+	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key) {}
+	virtual void pre_connect() {}
+	virtual void post_connect() {}
+	virtual void begin_update() {}
+	virtual bool end_update(float elapsed_time);
+};
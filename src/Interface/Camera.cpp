@@ -9,14 +9,14 @@
 #include "Camera.h"
 #include "../Utils.h"
 
-Camera::Camera() : m_max_update(15)
+Camera::Camera() : m_return_time(0.25f)
 {	
 	m_up = glm::vec3(0.f, 1.f, 0.f);
 	setup(false, glm::vec3(0.f, 0.f, 0.f), glm::vec3(0.f, 0.f, 1.f));
 
 	m_camera_pos = glm::vec3(0.f, 0.f, 0.f);
-	m_update = 0;
-	m_pos_index = 0;
+	m_returning = 0.f;
+	m_time = 0.f;
 	m_resting_yaw = m_yaw;
 	m_resting_pitch = m_pitch;
 }
@@ -55,8 +55,8 @@ void Camera::turn(float yaw_delta, float pitch_delta)
 	m_yaw = check_yaw_range(m_yaw + yaw_delta);
 	m_pitch = check_pitch_range(m_pitch + pitch_delta);
 	if (cur_yaw != m_yaw || cur_pitch != m_pitch) {
-		// on change start the update cycle
-		m_update = m_max_update;
+		// on change start turning back
+		m_returning = m_return_time;
 	}
 }
 
@@ -108,7 +108,7 @@ void Camera::process_player_input(Controller& ctlr)
 	ctlr.get_scroll_movement();
 }
 
-void Camera::update(const glm::mat4& player_trans)
+void Camera::update(const glm::mat4& player_trans, float elapsed_time)
 {	
 	if (!m_follow) {
 		m_focal_point = get_view_direction() * m_focal_length + m_pos;
@@ -119,30 +119,27 @@ void Camera::update(const glm::mat4& player_trans)
 	// transform the local camera position to world frame
 	glm::vec3 pos = glm::vec3(player_trans * glm::vec4(m_camera_pos, 1.f));
 	// camera stablization is provided to counter vibration of the vehicle
-	// it works by averaging the past positions
-	const int num_pos = 90; // ~1.5 second
-	m_pos_index %= num_pos;
-	int n = (int)m_pos_buffer.size();
-	if (n < num_pos) {
-		m_pos_buffer.push_back(pos);
-		n += 1;
-	} else {
-		m_pos_buffer[m_pos_index] = pos;
+	// it works by averaging the positions of the past 1.5 second
+	const float window = 1.5f;
+	m_time += elapsed_time;
+	m_pos_buffer.push_back(std::make_pair(m_time, pos));
+	while (m_pos_buffer.front().first < m_time - window) {
+		m_pos_buffer.pop_front();
 	}
-	m_pos_index += 1;
 
 	m_pos = glm::vec3(0.f, 0.f, 0.f);
 	for (auto& p : m_pos_buffer) {
-		m_pos += p;
+		m_pos += p.second;
 	}
-	m_pos /= (float)n;
+	m_pos /= (float)m_pos_buffer.size();
 
 	// gradually move focal point to initial position
 	// only re-point the camera when following the player
-	if (m_update > 0) {
-		float n = static_cast<float>(m_update - m_max_update) / static_cast<float>(m_max_update);
+	if (m_returning > 0.f) {
+		// 1/15 of the way back every 1/60 second
+		float n = glm::pow(14.f / 15.f, elapsed_time * 60.f) - 1.f;
 		turn((m_yaw - m_resting_yaw) * n, (m_pitch - m_resting_pitch) * n);
-		m_update -= 1;
+		m_returning -= elapsed_time;
 	}
 	glm::vec3 focal_point = get_view_direction() * glm::length(m_camera_pos) + m_camera_pos;
 	// transform to world frame
@@ -7,7 +7,8 @@
 #pragma once
 
 #include <glm/glm.hpp>
-#include <vector>
+#include <deque>
+#include <utility>
 #include "Controller.h"
 
 class Camera
@@ -48,15 +49,19 @@ protected:
 	// position of camera in the followed body's local frame
 	glm::vec3 m_camera_pos;
 	float m_resting_yaw, m_resting_pitch;
-	const int m_max_update;
-	int m_update, m_pos_index;
-	std::vector<glm::vec3> m_pos_buffer;
+	// the camera turns back to the resting direction for a while after a turn
+	const float m_return_time;
+	float m_returning;
+	// time and position of the past updates
+	float m_time;
+	std::deque<std::pair<float, glm::vec3>> m_pos_buffer;
 
 public:
 	Camera();
 	virtual ~Camera() {}
 	void setup(bool follow, const glm::vec3& eye, const glm::vec3& target);
 	void process_player_input(Controller& ctlr);
-	void update(const glm::mat4& player_trans);
+	void update(const glm::mat4& player_trans, float elapsed_time);
 	glm::mat4 get_view_matrix();
+	const glm::vec3& get_position() const { return m_pos; }
 };
@@ -53,3 +53,8 @@ glm::vec2 Controller::get_scroll_movement()
 	m_scroll_pos = { 0.f, 0.f };
 	return movement;
 }
+
+bool Controller::has_input() const
+{
+	return !m_keyboard.empty() || !m_mouse.empty() || m_scroll_pos != glm::vec2(0.f, 0.f);
+}
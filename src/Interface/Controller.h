@@ -28,4 +28,6 @@ public:
 	bool is_mouse_button_pressed(int key);
 	glm::vec2 get_cursor_movement();
 	glm::vec2 get_scroll_movement();
+	// any key or button pressed or the wheel scrolled
+	bool has_input() const;
 };
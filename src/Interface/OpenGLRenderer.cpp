@@ -5,6 +5,8 @@
  * found in the LICENSE file at the top of the source tree
  */
 #include <stdlib.h>
+#include <stddef.h>
+#include <algorithm>
 // The include file for GLAD includes the required OpenGL headers 
 // behind the scenes (like GL/gl.h) so be sure to include GLAD before 
 // other header files that require OpenGL (like GLFW).
@@ -119,6 +121,7 @@ OpenGLShape* create_from_json(json::object* obj, glm::mat4& trans)
 	}
 	
 	std::vector<uv_vertex> mesh;
+	std::vector<uint32_t> indices;
 	std::vector<int> face_index;
 	if (obj->contains("mesh")) {
 		std::vector<float> m = std::move(value_to<std::vector<float>>(obj->at("mesh")));
@@ -129,11 +132,15 @@ OpenGLShape* create_from_json(json::object* obj, glm::mat4& trans)
 		}
 	}
 
+	if (obj->contains("indices")) {
+		indices = std::move(value_to<std::vector<uint32_t>>(obj->at("indices")));		
+	}
+
 	if (obj->contains("face_index")) {
 		face_index = std::move(value_to<std::vector<int>>(obj->at("face_index")));		
 	}
 
-	OpenGLShape* shape = new OpenGLShape(mesh, std::move(face_index));
+	OpenGLShape* shape = new OpenGLShape(mesh, indices, std::move(face_index));
 	if (obj->contains("default_texture")) {
 		shape->set_default_texture(value_to<unsigned int>(obj->at("default_texture")));
 	}
@@ -153,34 +160,164 @@ OpenGLShape* OpenGLShape::from_json(const char* json, glm::mat4& trans)
 	return create_from_json(val.if_object(), trans);	
 }
 
-OpenGLShape::OpenGLShape(const std::vector<uv_vertex>& mesh, std::vector<int> face_index) : 
-	m_num_vertices((int)mesh.size()), m_default_texture(0)
+static OpenGLShape* create_from_binary(const char*& p, const char* end, glm::mat4& trans)
+{	// p is advanced past the descriptor
+	shape_desc_header header;
+	if ((size_t)(end - p) < sizeof(header)) return nullptr;
+	memcpy(&header, p, sizeof(header));
+	p += sizeof(header);
+	memcpy(&trans[0][0], header.trans, sizeof(header.trans));
+
+	if (header.num_children > 0) {
+		OpenGLShape* compound = new OpenGLShape();
+		for (uint32_t i = 0; i < header.num_children; i++) {
+			glm::mat4 m;
+			OpenGLShape* s = create_from_binary(p, end, m);
+			if (s == nullptr) {
+				debug_log("invalid binary shape descriptor\n");
+				break;
+			}
+			compound->add_child_shape(s, m);
+		}
+		return compound;
+	}
+
+	size_t mesh_size = header.num_vertices * sizeof(uv_vertex);
+	size_t index_size = header.num_indices * sizeof(uint32_t);
+	size_t face_size = header.num_faces * sizeof(int);
+	size_t texture_size = header.num_textures * sizeof(unsigned int);
+	if ((size_t)(end - p) < mesh_size + index_size + face_size + texture_size) return nullptr;
+	// the mesh and the indices are uploaded straight from the descriptor
+	const uv_vertex* mesh = (const uv_vertex*)p;
+	p += mesh_size;
+	const uint32_t* indices = (const uint32_t*)p;
+	p += index_size;
+	for (uint32_t i = 0; i < header.num_indices; i++) {
+		if (indices[i] >= header.num_vertices) return nullptr;
+	}
+	std::vector<int> face_index(header.num_faces);
+	memcpy(face_index.data(), p, face_size);
+	p += face_size;
+
+	OpenGLShape* shape = new OpenGLShape(mesh, (int)header.num_vertices, 
+		indices, (int)header.num_indices, std::move(face_index));
+	shape->set_default_texture(header.default_texture);
+	const unsigned int* textures = (const unsigned int*)p;
+	for (uint32_t i = 0; i < header.num_textures; i++) {
+		shape->add_texture(textures[i]);
+	}
+	p += texture_size;
+
+	for (uint32_t l = 0; l < header.num_lods; l++) {
+		lod_desc_header lod_header;
+		if ((size_t)(end - p) < sizeof(lod_header)) break;
+		memcpy(&lod_header, p, sizeof(lod_header));
+		p += sizeof(lod_header);
+		mesh_size = lod_header.num_vertices * sizeof(uv_vertex);
+		index_size = lod_header.num_indices * sizeof(uint32_t);
+		face_size = lod_header.num_faces * sizeof(int);
+		if ((size_t)(end - p) < mesh_size + index_size + face_size) break;
+		mesh = (const uv_vertex*)p;
+		indices = (const uint32_t*)(p + mesh_size);
+		std::vector<int> lod_face_index(lod_header.num_faces);
+		memcpy(lod_face_index.data(), p + mesh_size + index_size, face_size);
+		p += mesh_size + index_size + face_size;
+
+		bool valid = true;
+		for (uint32_t i = 0; i < lod_header.num_indices; i++) {
+			if (indices[i] >= lod_header.num_vertices) valid = false;
+		}
+		if (!valid) continue;
+		shape->add_level(lod_header.distance, mesh, (int)lod_header.num_vertices,
+			indices, (int)lod_header.num_indices, std::move(lod_face_index));
+	}
+	return shape;
+}
+
+OpenGLShape* OpenGLShape::from_binary(const char* desc, size_t size, glm::mat4& trans)
 {
-	m_face_index = std::move(face_index);
-	std::vector<glm::vec3> normal;
-	const uv_vertex* p = mesh.data();
-	for (int n = 0; n < m_num_vertices; n += 3) {
-		glm::vec3 p1(p[n].x, p[n].y, p[n].z);
-		glm::vec3 p2(p[n + 1].x, p[n + 1].y, p[n + 1].z);
-		glm::vec3 p3(p[n + 2].x, p[n + 2].y, p[n + 2].z);
-		// one normal vector for each vertex!!!
-		glm::vec3 norm = glm::normalize(glm::cross(p2 - p1, p3 - p1));
-		normal.push_back(norm);
-		normal.push_back(norm);
-		normal.push_back(norm);
-	}
-	glGenVertexArrays(1, &m_VAO);
-	glGenBuffers(1, &m_VBO);
-
-	glBindVertexArray(m_VAO);
-	glBindBuffer(GL_ARRAY_BUFFER, m_VBO);
+	return create_from_binary(desc, desc + size, trans);
+}
+
+static std::vector<glm::vec3> compute_normals(const uv_vertex* mesh, int num_vertices, 
+	const uint32_t* indices, int num_indices)
+{	
+	std::vector<glm::vec3> normal(num_vertices, glm::vec3(0.f));
+	auto position = [mesh](uint32_t i) { return glm::vec3(mesh[i].x, mesh[i].y, mesh[i].z); };
+	if (indices == NULL) {
+		// one (flat) normal vector for each vertex!!!
+		for (int n = 0; n + 2 < num_vertices; n += 3) {
+			glm::vec3 p1 = position(n), p2 = position(n + 1), p3 = position(n + 2);
+			glm::vec3 norm = glm::normalize(glm::cross(p2 - p1, p3 - p1));
+			normal[n] = normal[n + 1] = normal[n + 2] = norm;
+		}
+		return normal;
+	}
+	// shared vertices get the (smooth) average of the triangle normals
+	// weighted by the triangle area, degenerate triangles add nothing
+	for (int n = 0; n + 2 < num_indices; n += 3) {
+		uint32_t i1 = indices[n], i2 = indices[n + 1], i3 = indices[n + 2];
+		glm::vec3 p1 = position(i1);
+		glm::vec3 norm = glm::cross(position(i2) - p1, position(i3) - p1);
+		normal[i1] += norm;
+		normal[i2] += norm;
+		normal[i3] += norm;
+	}
+	for (glm::vec3& norm : normal) {
+		float len = glm::length(norm);
+		norm = len > 0.f ? norm / len : glm::vec3(0.f, 1.f, 0.f);
+	}
+	return normal;
+}
+
+OpenGLShape::OpenGLShape(const uv_vertex* mesh, int num_vertices, 
+	const uint32_t* indices, int num_indices, std::vector<int> face_index) : 
+	m_default_texture(0), m_bound_center(0.f), m_bound_radius(-1.f)
+{
+	if (num_vertices > 0) {
+		// the sphere around the box that bounds the mesh
+		glm::vec3 lo(mesh[0].x, mesh[0].y, mesh[0].z), hi = lo;
+		for (int i = 1; i < num_vertices; i++) {
+			glm::vec3 p(mesh[i].x, mesh[i].y, mesh[i].z);
+			lo = glm::min(lo, p);
+			hi = glm::max(hi, p);
+		}
+		m_bound_center = (lo + hi) * .5f;
+		m_bound_radius = 0.f;
+		for (int i = 0; i < num_vertices; i++) {
+			glm::vec3 p(mesh[i].x, mesh[i].y, mesh[i].z);
+			m_bound_radius = glm::max(m_bound_radius, glm::length(p - m_bound_center));
+		}
+	}
+	add_level(0.f, mesh, num_vertices, indices, num_indices, std::move(face_index));
+}
+
+void OpenGLShape::add_level(float distance, const uv_vertex* mesh, int num_vertices, 
+	const uint32_t* indices, int num_indices, std::vector<int> face_index)
+{
+	if (num_indices == 0) indices = NULL;
+	mesh_level level = { distance, 0, 0, 0, num_vertices, num_indices, std::move(face_index) };
+	std::vector<glm::vec3> normal = compute_normals(mesh, num_vertices, indices, num_indices);
+
+	glGenVertexArrays(1, &level.VAO);
+	glGenBuffers(1, &level.VBO);
+
+	glBindVertexArray(level.VAO);
+	glBindBuffer(GL_ARRAY_BUFFER, level.VBO);
 	
-	size_t offset = sizeof(uv_vertex) * m_num_vertices;
+	size_t offset = sizeof(uv_vertex) * num_vertices;
 	size_t buffer_size = offset + normal.size() * sizeof(glm::vec3);
 	glBufferData(GL_ARRAY_BUFFER, buffer_size, NULL, GL_STATIC_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, offset, mesh.data());
+	glBufferSubData(GL_ARRAY_BUFFER, 0, offset, mesh);
 	glBufferSubData(GL_ARRAY_BUFFER, offset, normal.size() * sizeof(glm::vec3), normal.data());
 
+	if (indices != NULL) {
+		// the element buffer binding is part of the vertex array state
+		glGenBuffers(1, &level.EBO);
+		glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, level.EBO);
+		glBufferData(GL_ELEMENT_ARRAY_BUFFER, num_indices * sizeof(uint32_t), indices, GL_STATIC_DRAW);
+	}
+
 	// position attribute
 	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(uv_vertex), (void*)0);
 	glEnableVertexAttribArray(0);
@@ -190,77 +327,144 @@ OpenGLShape::OpenGLShape(const std::vector<uv_vertex>& mesh, std::vector<int> fa
 
 	glVertexAttribPointer(2, 3, GL_FLOAT, GL_FALSE, sizeof(glm::vec3), (void*)offset);
 	glEnableVertexAttribArray(2);
+	m_levels.push_back(std::move(level));
 }
 
 void OpenGLShape::add_child_shape(OpenGLShape* shape, glm::mat4 trans)
 {
 	child_shape child = { shape, trans };
 	m_child_shapes.push_back(child);
+	if (shape->m_bound_radius >= 0.f) {
+		add_bound(glm::vec3(trans * glm::vec4(shape->m_bound_center, 1.f)), shape->m_bound_radius);
+	}
 }
 
-void OpenGLShape::draw(unsigned int shader_program, const glm::mat4& trans, 
-	const std::map<int, int>& texture_id_map) const
+void OpenGLShape::add_bound(const glm::vec3& center, float radius)
+{	// grow the bounding sphere to enclose the other sphere
+	if (m_bound_radius < 0.f) {
+		m_bound_center = center;
+		m_bound_radius = radius;
+		return;
+	}
+	glm::vec3 d = center - m_bound_center;
+	float distance = glm::length(d);
+	if (distance + radius <= m_bound_radius) return; // already enclosed
+	if (distance + m_bound_radius <= radius) {
+		// the other sphere encloses this one
+		m_bound_center = center;
+		m_bound_radius = radius;
+		return;
+	}
+	float r = (distance + m_bound_radius + radius) * .5f;
+	m_bound_center += d * ((r - m_bound_radius) / distance);
+	m_bound_radius = r;
+}
+
+static glm::mat3 normal_matrix(const glm::mat4& model)
+{	// computed once per instance instead of per vertex in the shader
+	glm::mat3 m(model);
+	// the transforms are mostly rigid (rotation and translation) where
+	// the inverse transpose of the rotation is the rotation itself
+	glm::mat3 d = glm::transpose(m) * m;
+	bool rigid = true;
+	for (int c = 0; c < 3; c++) {
+		for (int r = 0; r < 3; r++) {
+			if (glm::abs(d[c][r] - (c == r ? 1.f : 0.f)) > 1e-4f) rigid = false;
+		}
+	}
+	return rigid ? m : glm::transpose(glm::inverse(m));
+}
+
+void OpenGLShape::collect_instances(const glm::mat4& trans, const glm::vec3& eye, 
+	const frustum& view, instance_map& instances, render_stats& stats) const
 {
+	if (m_bound_radius < 0.f) return;
+	if (!view.intersects(glm::vec3(trans * glm::vec4(m_bound_center, 1.f)), m_bound_radius)) {
+		// nothing of the shape and its children is in the view
+		stats.culled++;
+		return;
+	}
 	for (const child_shape& child: m_child_shapes) {
 		// combine the child transform
-		child.shape->draw(shader_program, trans * child.trans, texture_id_map);
+		child.shape->collect_instances(trans * child.trans, eye, view, instances, stats);
 	}
-	if (m_num_vertices == 0) return;
+	if (m_levels.empty() || m_levels[0].num_vertices == 0) return;
 
-	glm::mat4 model = trans;
-	glUniformMatrix4fv(glGetUniformLocation(shader_program, "model"), 1, GL_FALSE, &model[0][0]);
-	
-	// if no texture is set, draw wireframe
-	glBindVertexArray(m_VAO);
-	for (int i = 0; i < m_face_index.size(); i++)
+	// the coarsest level within the distance from the camera
+	float distance = glm::length(glm::vec3(trans[3]) - eye);
+	int level = 0;
+	for (int i = 1; i < m_levels.size(); i++) {
+		if (distance >= m_levels[i].distance) level = i;
+	}
+	instances[mesh_key(this, level)].push_back({ trans, normal_matrix(trans) });
+}
+
+void OpenGLShape::queue_draw_calls(int level, int num_instances, size_t instance_offset, 
+	const std::map<int, int>& texture_id_map, std::vector<draw_call>& queue) const
+{
+	const mesh_level& mesh = m_levels[level];
+	const std::vector<int>& face_index = mesh.face_index;
+	int count = (mesh.EBO != 0) ? mesh.num_indices : mesh.num_vertices;
+	for (int i = 0; i < face_index.size(); i++)
 	{
-		int index = m_face_index[i];
-		int n = (i == m_face_index.size() - 1) ? m_num_vertices - index : m_face_index[i + 1] - index;
+		int index = face_index[i];
+		int n = (i == face_index.size() - 1) ? count - index : face_index[i + 1] - index;
 		int t = (i < m_textures.size()) ? m_textures[i] : m_default_texture;
 		
+		// if no texture is set, draw wireframe
 		if (t != 0) t = texture_id_map.at(t);
-		glPolygonMode(GL_FRONT_AND_BACK, t == 0 ? GL_LINE : GL_FILL);
-		glActiveTexture(GL_TEXTURE0 + t);
-		glBindTexture(GL_TEXTURE_2D, t);
-		glUniform1i(glGetUniformLocation(shader_program, "txtr"), t);
-		// draw one face
-		glDrawArrays(GL_TRIANGLES, index, n);
+		draw_call d = { (unsigned int)t, mesh.VAO, mesh.EBO != 0, index, n, num_instances, instance_offset };
+		queue.push_back(d);
 	}
 }
 
 OpenGLShape::~OpenGLShape()
 {
-	glDeleteVertexArrays(1, &m_VAO);
-	glDeleteBuffers(1, &m_VBO);
+	for (mesh_level& level : m_levels) {
+		glDeleteVertexArrays(1, &level.VAO);
+		glDeleteBuffers(1, &level.VBO);
+		if (level.EBO != 0) glDeleteBuffers(1, &level.EBO);
+	}
 }
 
 //~~~
 // OpenGLRenderer
 //~~~
-void OpenGLRenderer::add_shape(int id, const char* json)
+void OpenGLRenderer::add_template(int id, const char* desc, size_t size)
+{
+	glm::mat4 trans; // not used, each shape has its own
+	OpenGLShape* shape = OpenGLShape::from_binary(desc, size, trans);
+	if (shape == nullptr) {
+		debug_log("invalid shape template #%d\n", id);
+		return;
+	}
+	m_templates.insert(std::make_pair(id, shape));
+}
+
+void OpenGLRenderer::add_shape(int id, int template_id, const glm::mat4& trans)
 {
-	glm::mat4 trans;
-	OpenGLShape* shape = OpenGLShape::from_json(json, trans);
-	if (shape != nullptr) {
-		m_shapes.insert(std::make_pair(id, shape));
-		m_trans.insert(std::make_pair(id, trans));
+	auto t = m_templates.find(template_id);
+	if (t == m_templates.end()) {
+		debug_log("adding a shape with a template that does not exist\n");
+		return;
+	}
+	if (!m_shapes.insert_at(id, (*t).second, trans)) {
+		debug_log("adding a shape that already exists\n");
 	}
 }
 
 void OpenGLRenderer::remove_shape(int id)
 {
-	if (m_shapes.find(id) == m_shapes.end()) {
+	// the template is kept for the next shape of its kind
+	if (!m_shapes.erase(id)) {
 		debug_log("removing a shape that does not exist\n");
-		return;
 	}
-	delete m_shapes[id];
-	m_shapes.erase(id);
-	m_trans.erase(id);
 }
 
 void OpenGLRenderer::update_shape(int id, const glm::mat4& trans)
 {
-	m_trans[id] = trans;
+	int pos = m_shapes.find(id);
+	if (pos >= 0) m_shapes.column<1>()[pos] = trans;
 }
 
 static void reshape(GLFWwindow* window, int width, int height)
@@ -310,15 +514,25 @@ int OpenGLRenderer::init(const char* title)
 
 	m_shader_program = setupShaderProgram();
 	glUseProgram(m_shader_program);
+	glGenBuffers(1, &m_instance_buffer);
+	m_uniforms.view = glGetUniformLocation(m_shader_program, "view");
+	m_uniforms.projection = glGetUniformLocation(m_shader_program, "projection");
+	m_uniforms.txtr = glGetUniformLocation(m_shader_program, "txtr");
+	m_uniforms.light_ambient = glGetUniformLocation(m_shader_program, "light.ambient");
+	m_uniforms.light_direction = glGetUniformLocation(m_shader_program, "light.direction");
 
-	glm::mat4 projection = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 600.0f);
-	glUniformMatrix4fv(glGetUniformLocation(m_shader_program, "projection"), 1, GL_FALSE, &projection[0][0]);
+	// all textures are bound to texture unit 0
+	glActiveTexture(GL_TEXTURE0);
+	glUniform1i(m_uniforms.txtr, 0);
+
+	m_projection = glm::perspective(glm::radians(60.0f), (float)width / (float)height, 0.1f, 600.0f);
+	glUniformMatrix4fv(m_uniforms.projection, 1, GL_FALSE, &m_projection[0][0]);
 
 	// a directional light vector pointing from the light source
 	glm::vec3 light_direction = glm::normalize(glm::vec3(-1.f, -3.f, 0.f));
 	float light_ambient = 0.6f;
-	glUniform1f(glGetUniformLocation(m_shader_program, "light.ambient"), light_ambient);
-	glUniform3fv(glGetUniformLocation(m_shader_program, "light.direction"), 1, &light_direction[0]);
+	glUniform1f(m_uniforms.light_ambient, light_ambient);
+	glUniform3fv(m_uniforms.light_direction, 1, &light_direction[0]);
 	glEnable(GL_DEPTH_TEST);
 	// Swap interval 0 which is default means to swap buffers immediately as glfwSwapBuffers()
 	// is called. This allows render loop to potentially run faster than hardware is capable of 
@@ -332,6 +546,8 @@ int OpenGLRenderer::init(const char* title)
 
 void OpenGLRenderer::teardown()
 {
+	glDeleteBuffers(1, &m_instance_buffer);
+	m_instance_buffer = 0;
 	glDeleteProgram(m_shader_program);
 	m_shader_program = NULL;
 
@@ -353,21 +569,104 @@ bool OpenGLRenderer::render(float elapsed_time)
 
 	// update camera and render the scene
 	m_camera.process_player_input(m_controller);
-	m_camera.update(m_player_trans);
+	m_camera.update(m_player_trans, elapsed_time);
 	glm::mat4 view = m_camera.get_view_matrix();
-	glUniformMatrix4fv(glGetUniformLocation(m_shader_program, "view"), 1, GL_FALSE, &view[0][0]);
+	glUniformMatrix4fv(m_uniforms.view, 1, GL_FALSE, &view[0][0]);
 	
-	for (auto& s : m_shapes) {
-		if (s.second != NULL) {
-			s.second->draw(m_shader_program, m_trans[s.first], m_texture_id_map);
+	// group the meshes to draw, the templates outlive the shapes 
+	// so the groups are kept from frame to frame
+	m_stats = {};
+	frustum view_frustum(m_projection * view);
+	for (auto& i : m_instances) i.second.clear();
+	const std::vector<const OpenGLShape*>& shapes = m_shapes.column<0>();
+	const std::vector<glm::mat4>& trans = m_shapes.column<1>();
+	for (size_t i = 0; i < shapes.size(); i++) {
+		if (shapes[i] != NULL) {
+			shapes[i]->collect_instances(trans[i], m_camera.get_position(), 
+				view_frustum, m_instances, m_stats);
 		}
 	}
+
+	// upload the model transforms of all instances at once 
+	m_instance_data.clear();
+	for (auto& i : m_instances) {
+		m_instance_data.insert(m_instance_data.end(), i.second.begin(), i.second.end());
+	}
+	glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+	glBufferData(GL_ARRAY_BUFFER, m_instance_data.size() * sizeof(instance_attributes), m_instance_data.data(), GL_STREAM_DRAW);
+
+	m_draw_queue.clear();
+	size_t offset = 0;
+	for (auto& i : m_instances) {
+		if (i.second.empty()) continue;
+		const OpenGLShape::mesh_key& mesh = i.first;
+		mesh.first->queue_draw_calls(mesh.second, (int)i.second.size(), offset, m_texture_id_map, m_draw_queue);
+		offset += i.second.size() * sizeof(instance_attributes);
+		m_stats.meshes++;
+		m_stats.instances += (int)i.second.size();
+	}
+	draw_queue();
+	debug_log_mute("culled: %d meshes: %d instances: %d draw calls: %d state changes: %d\n", 
+		m_stats.culled, m_stats.meshes, m_stats.instances, m_stats.draw_calls, m_stats.state_changes);
 	debug_log_mute("elapsed time (sec): %f fps: %f\n", elapsed_time, 1.f / elapsed_time);
 	glfwSwapBuffers((GLFWwindow*)m_window);
 	glfwPollEvents();
 	return true;
 }
 
+void OpenGLRenderer::draw_queue()
+{	// sorted by texture then the mesh so the state is only changed when needed
+	std::sort(m_draw_queue.begin(), m_draw_queue.end());
+
+	int mode = -1;
+	unsigned int texture = (unsigned int)-1, VAO = 0;
+	for (const draw_call& d : m_draw_queue) {
+		int m = (d.texture == 0) ? GL_LINE : GL_FILL;
+		if (m != mode) {
+			glPolygonMode(GL_FRONT_AND_BACK, m);
+			mode = m;
+			m_stats.state_changes++;
+		}
+		if (d.texture != texture) {
+			glBindTexture(GL_TEXTURE_2D, d.texture);
+			texture = d.texture;
+			m_stats.state_changes++;
+		}
+		if (d.VAO != VAO) {
+			glBindVertexArray(d.VAO);
+			VAO = d.VAO;
+			m_stats.state_changes++;
+
+			// the model transform (location = 3 to 6 for the 4 columns) and the normal 
+			// matrix (location = 7 to 9) are per-instance attributes, the pointers are 
+			// part of the vertex array state and the instance buffer is still bound from the upload
+			auto o = m_instance_offsets.find(VAO);
+			if (o == m_instance_offsets.end() || (*o).second != d.instance_offset) {
+				for (int c = 0; c < 4; c++) {
+					glVertexAttribPointer(3 + c, 4, GL_FLOAT, GL_FALSE, sizeof(instance_attributes), 
+						(void*)(d.instance_offset + offsetof(instance_attributes, model) + c * sizeof(glm::vec4)));
+					glEnableVertexAttribArray(3 + c);
+					glVertexAttribDivisor(3 + c, 1);
+				}
+				for (int c = 0; c < 3; c++) {
+					glVertexAttribPointer(7 + c, 3, GL_FLOAT, GL_FALSE, sizeof(instance_attributes), 
+						(void*)(d.instance_offset + offsetof(instance_attributes, normal) + c * sizeof(glm::vec3)));
+					glEnableVertexAttribArray(7 + c);
+					glVertexAttribDivisor(7 + c, 1);
+				}
+				m_instance_offsets[VAO] = d.instance_offset;
+				m_stats.state_changes++;
+			}
+		}
+		if (d.indexed) {
+			glDrawElementsInstanced(GL_TRIANGLES, d.count, GL_UNSIGNED_INT, (void*)(d.first * sizeof(uint32_t)), d.num_instances);
+		} else {
+			glDrawArraysInstanced(GL_TRIANGLES, d.first, d.count, d.num_instances);
+		}
+		m_stats.draw_calls++;
+	}
+}
+
 unsigned int OpenGLRenderer::create_texture(size_t width, size_t height, unsigned char* data)
 {
 	unsigned int texture;
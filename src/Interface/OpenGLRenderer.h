@@ -12,6 +12,7 @@
 #include "Camera.h"
 #include "Controller.h"
 #include "Shapes.h"
+#include "SlotMap.h"
 
 struct GLFWwindow;
 
@@ -29,6 +30,66 @@ public:
 	void process_keyboard_input(int key, int scancode, int action, int mods);
 };
 
+// per-instance vertex attributes
+struct instance_attributes
+{
+	glm::mat4 model;
+	glm::mat3 normal; // the inverse transpose of the model rotation
+};
+
+// one draw call for a face of all instances of a mesh
+struct draw_call
+{
+	unsigned int texture;	// OpenGL texture, 0 to draw wireframe
+	unsigned int VAO;
+	bool indexed;			// glDrawElementsInstanced or glDrawArraysInstanced
+	int first, count;		// indices (or vertices) of the face
+	int num_instances;
+	size_t instance_offset; // attributes of the instances in the instance buffer
+
+	// sorted by texture (and polygon mode) first then the mesh
+	bool operator<(const draw_call& other) const {
+		if (texture != other.texture) return texture < other.texture;
+		if (VAO != other.VAO) return VAO < other.VAO;
+		return first < other.first;
+	}
+};
+
+// the 6 planes of the view frustum from the projection * view matrix
+// each plane is (normal, distance) with the normal pointing inside
+struct frustum
+{
+	glm::vec4 planes[6];
+
+	frustum() {}
+	frustum(const glm::mat4& m) {
+		for (int i = 0; i < 3; i++) {
+			glm::vec4 row(m[0][i], m[1][i], m[2][i], m[3][i]);
+			glm::vec4 w(m[0][3], m[1][3], m[2][3], m[3][3]);
+			planes[i * 2] = w + row;
+			planes[i * 2 + 1] = w - row;
+		}
+		for (glm::vec4& p : planes) p = p / glm::length(glm::vec3(p));
+	}
+	// true if any part of the sphere is inside
+	bool intersects(const glm::vec3& center, float radius) const {
+		for (const glm::vec4& p : planes) {
+			if (glm::dot(glm::vec3(p), center) + p.w < -radius) return false;
+		}
+		return true;
+	}
+};
+
+// counters of one frame
+struct render_stats
+{
+	int culled;	// shapes and child shapes outside of the view
+	int meshes;
+	int instances;
+	int draw_calls;
+	int state_changes; // polygon mode, texture, vertex array and instance buffer changes
+};
+
 class OpenGLShape
 {
 protected:
@@ -36,29 +97,60 @@ protected:
 		OpenGLShape* shape;
 		glm::mat4 trans;
 	};
-	// OpenGL vertex Array Object and 
-	unsigned int m_VAO;
-	// OpenGL Vertex Buffer Object
-	unsigned int m_VBO;
-	
-	int m_num_vertices;
-	std::vector<int> m_face_index;
+	struct mesh_level {
+		float distance; // the level is used from this distance to the camera
+		// OpenGL vertex Array Object and 
+		unsigned int VAO;
+		// OpenGL Vertex Buffer Object
+		unsigned int VBO;
+		// OpenGL Element Buffer Object, 0 if the mesh is not indexed
+		unsigned int EBO;
+		int num_vertices;
+		int num_indices;
+		std::vector<int> face_index;
+	};
+	// levels of detail from the finest to the coarsest
+	std::vector<mesh_level> m_levels;
 	std::vector<unsigned int> m_textures;
 	unsigned int m_default_texture;
 	std::vector<child_shape> m_child_shapes;
 
+	// bounding sphere of the shape and its children in the shape's frame
+	// the transforms are rigid so the radius holds in any frame
+	glm::vec3 m_bound_center;
+	float m_bound_radius; // negative if empty
+	void add_bound(const glm::vec3& center, float radius);
+
 public:
-	OpenGLShape(const std::vector<uv_vertex>& mesh, std::vector<int> face_index);
+	OpenGLShape(const std::vector<uv_vertex>& mesh, const std::vector<uint32_t>& indices, std::vector<int> face_index) :
+		OpenGLShape(mesh.data(), (int)mesh.size(), indices.data(), (int)indices.size(), std::move(face_index)) {}
+	// indices can be NULL for a mesh that is not indexed
+	OpenGLShape(const uv_vertex* mesh, int num_vertices, 
+		const uint32_t* indices, int num_indices, std::vector<int> face_index);
 	// Compound shape constructor
-	OpenGLShape() : m_VAO(0), m_VBO(0),
-		m_num_vertices(0), m_default_texture(0) {}
+	OpenGLShape() : m_default_texture(0), m_bound_center(0.f), m_bound_radius(-1.f) {}
+	// adds a coarser level of detail
+	void add_level(float distance, const uv_vertex* mesh, int num_vertices, 
+		const uint32_t* indices, int num_indices, std::vector<int> face_index);
 	void add_child_shape(OpenGLShape* shape, glm::mat4 trans);
 	void add_texture(unsigned int txtr) { m_textures.push_back(txtr); }
 	void set_default_texture(unsigned int txtr) { m_default_texture = txtr; }
 	virtual ~OpenGLShape();
 
-	void draw(unsigned int shader_program, const glm::mat4& trans, const std::map<int, int>& texture_id_map) const;
+	// a mesh to draw is a shape and its level of detail
+	typedef std::pair<const OpenGLShape*, int> mesh_key;
+	typedef std::map<mesh_key, std::vector<instance_attributes>> instance_map;
+	// adds the model transforms of the meshes of this shape and its children
+	// that are in the view, eye is the camera position to pick the level of detail
+	void collect_instances(const glm::mat4& trans, const glm::vec3& eye, 
+		const frustum& view, instance_map& instances, render_stats& stats) const;
+	// queues the draw calls for all instances of a mesh, their 
+	// attributes are in the instance buffer from instance_offset on
+	void queue_draw_calls(int level, int num_instances, size_t instance_offset, 
+		const std::map<int, int>& texture_id_map, std::vector<draw_call>& queue) const;
 	
+	static OpenGLShape* from_binary(const char* desc, size_t size, glm::mat4& trans);
+	// for debugging only
 	static OpenGLShape* from_json(const char* json, glm::mat4& trans);
 };
 
@@ -72,20 +164,43 @@ protected:
 	Camera m_camera;
 
 	int m_next_shape_id;
-	std::map<int, const OpenGLShape*> m_shapes;
-	std::map<int, glm::mat4> m_trans;
+	std::map<int, const OpenGLShape*> m_templates; // owns the vertex buffers
+	slot_map<const OpenGLShape*, glm::mat4> m_shapes; // shapes share the templates
 	std::map<int, int> m_texture_id_map; // maps shape texture id to OpenGL texture id
 
+	// the shapes are drawn by mesh, each face once for all instances of the mesh
+	OpenGLShape::instance_map m_instances;
+	std::vector<instance_attributes> m_instance_data;
+	unsigned int m_instance_buffer;
+	// the draw calls of a frame sorted to skip redundant state changes
+	std::vector<draw_call> m_draw_queue;
+	std::map<unsigned int, size_t> m_instance_offsets; // per vertex array 
+	render_stats m_stats;
+	glm::mat4 m_projection;
+
+	// resolved once after the shader program is linked
+	struct {
+		int view;
+		int projection;
+		int txtr;
+		int light_ambient;
+		int light_direction;
+	} m_uniforms;
+
+	void draw_queue();
+
 	unsigned int create_texture(size_t width, size_t height, unsigned char* data);
 
 public:
-	OpenGLRenderer() : m_window(NULL), m_shader_program(0), m_next_shape_id(0), m_player_trans(1.f) {}
+	OpenGLRenderer() : m_window(NULL), m_shader_program(0), m_next_shape_id(0), m_player_trans(1.f), 
+		m_instance_buffer(0), m_stats(), m_projection(1.f), m_uniforms() {}
 	virtual ~OpenGLRenderer() { 
-		for (auto& s : m_shapes) delete s.second;
+		for (auto& t : m_templates) delete t.second;
 		teardown(); 
 	}
 	int init(const char* title);
 	void teardown();
+	const render_stats& get_render_stats() const { return m_stats; }
 	
 	void setup_camera(bool follow, const glm::vec3& eye, const glm::vec3& target);
 	bool render(float elapsed_time);
@@ -94,10 +209,11 @@ public:
 	virtual int how_many_controllers() { return 1; }
 	virtual Controller& get_controller(int) { return m_controller; }
 
-	virtual void add_shape(int id, const char* json);
+	virtual void add_template(int id, const char* desc, size_t size);
+	virtual void add_shape(int id, int template_id, const glm::mat4& trans);
 	virtual void update_shape(int id, const glm::mat4& trans);
 	virtual void remove_shape(int id);
-	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data) {
+	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t) {
 		m_texture_id_map.insert({ id, create_texture(width, height, data) });
 	}
 	virtual void set_player_transform(int which, const glm::mat4& trans) { if (which == 0) m_player_trans = trans; }
@@ -0,0 +1,169 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#include <thread>
+#include "RenderThread.h"
+#include "OpenGLRenderer.h"
+#include "../Utils.h"
+
+RenderThread::RenderThread(OpenGLRenderer& renderer, float step_rate) :
+	m_renderer(renderer), m_running(true), m_steps(0), m_player_trans(1.f), m_frame(0)
+{
+	m_step = std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+		std::chrono::duration<float>(1.f / step_rate));
+	m_next_step = std::chrono::steady_clock::now();
+}
+
+//~~~
+// render thread
+//~~~
+void RenderThread::run()
+{
+	std::chrono::steady_clock::time_point last_time = std::chrono::steady_clock::now();
+	while (m_running) {
+		if (m_snapshots.fetch()) {
+			apply_snapshot(m_snapshots.read_buffer());
+		}
+		std::chrono::steady_clock::time_point cur_time = std::chrono::steady_clock::now();
+		float elapsed_time = std::chrono::duration<float>(cur_time - last_time).count();
+		last_time = cur_time;
+		if (!m_renderer.render(elapsed_time)) {
+			m_running = false;
+		}
+
+		// hand the inputs polled during rendering to the simulation
+		std::lock_guard<std::mutex> lock(m_lock);
+		m_input.sync_from(m_renderer.get_controller(0));
+	}
+}
+
+void RenderThread::apply_snapshot(const scene_snapshot& scene)
+{
+	{	// the templates used by the snapshot were queued before it was published
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (auto& t : m_templates) {
+			m_renderer.add_template(t.first, t.second.data(), t.second.size());
+		}
+		m_templates.clear();
+	}
+
+	// stamp the shapes in the snapshot, the ones left behind were removed
+	m_frame++;
+	std::vector<unsigned int>& frames = m_rendered.column<0>();
+	std::vector<unsigned int>& changed = m_rendered.column<1>();
+	for (const scene_snapshot::shape& s : scene.shapes) {
+		int pos = m_rendered.find(s.id);
+		if (pos >= 0) {
+			frames[pos] = m_frame;
+			// only the shapes that moved since the snapshot last applied
+			if (changed[pos] != s.changed) {
+				changed[pos] = s.changed;
+				m_renderer.update_shape(s.id, s.trans);
+			}
+		}
+	}
+	// backwards since the last shape takes the place of an erased one
+	for (int pos = (int)m_rendered.size() - 1; pos >= 0; pos--) {
+		if (frames[pos] != m_frame) {
+			int id = m_rendered.ids()[pos];
+			m_renderer.remove_shape(id);
+			m_rendered.erase(id);
+		}
+	}
+	// added after the removal since a new shape can reuse the slot of a removed one
+	for (const scene_snapshot::shape& s : scene.shapes) {
+		if (m_rendered.insert_at(s.id, m_frame, s.changed)) {
+			m_renderer.add_shape(s.id, s.template_id, s.trans);
+		}
+	}
+	m_renderer.set_player_transform(0, scene.player_trans);
+}
+
+void RenderThread::setup_camera(bool follow, const glm::vec3& eye, const glm::vec3& target)
+{
+	m_renderer.setup_camera(follow, eye, target);
+}
+
+void RenderThread::add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key)
+{	// textures are only added while connecting on the render thread
+	m_renderer.add_texture(id, width, height, data, key);
+}
+
+void RenderThread::pre_connect()
+{
+	m_renderer.pre_connect();
+}
+
+void RenderThread::post_connect()
+{
+	m_renderer.post_connect();
+}
+
+//~~~
+// simulation thread
+//~~~
+Controller& RenderThread::get_controller(int)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_controller.sync_from(m_input);
+	return m_controller;
+}
+
+void RenderThread::add_template(int id, const char* desc, size_t size)
+{
+	std::lock_guard<std::mutex> lock(m_lock);
+	m_templates.push_back(std::make_pair(id, std::string(desc, size)));
+}
+
+void RenderThread::add_shape(int id, int template_id, const glm::mat4& trans)
+{
+	if (!m_scene.insert_at(id, template_id, trans, m_steps)) {
+		debug_log("adding a shape that already exists\n");
+	}
+}
+
+void RenderThread::update_shape(int id, const glm::mat4& trans)
+{
+	int pos = m_scene.find(id);
+	if (pos < 0) {
+		debug_log("updating a shape that does not exist\n");
+		return;
+	}
+	// the observer only sends the shapes that moved
+	m_scene.column<1>()[pos] = trans;
+	m_scene.column<2>()[pos] = m_steps;
+}
+
+void RenderThread::remove_shape(int id)
+{
+	m_scene.erase(id);
+}
+
+bool RenderThread::end_update(float elapsed_time)
+{	// the buffers are reused so no allocation once the scene is stable
+	scene_snapshot& scene = m_snapshots.write_buffer();
+	scene.shapes.clear();
+	const std::vector<int>& ids = m_scene.ids();
+	const std::vector<int>& templates = m_scene.column<0>();
+	const std::vector<glm::mat4>& trans = m_scene.column<1>();
+	const std::vector<unsigned int>& changed = m_scene.column<2>();
+	for (size_t i = 0; i < ids.size(); i++) {
+		scene.shapes.push_back({ ids[i], templates[i], trans[i], changed[i] });
+	}
+	scene.player_trans = m_player_trans;
+	m_snapshots.publish();
+	m_steps++;
+
+	// wait for the next step, start over if the simulation falls behind
+	m_next_step += m_step;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	if (m_next_step < now) {
+		m_next_step = now;
+	} else {
+		std::this_thread::sleep_until(m_next_step);
+	}
+	return m_running;
+}
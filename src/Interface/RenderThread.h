@@ -0,0 +1,118 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <glm/glm.hpp>
+#include "Renderer.h"
+#include "Controller.h"
+#include "SlotMap.h"
+
+class OpenGLRenderer;
+
+// the state of the scene at the end of a simulation step
+struct scene_snapshot
+{
+	struct shape {
+		int id;
+		int template_id;
+		glm::mat4 trans;
+		unsigned int changed; // the step the transform last changed
+	};
+	std::vector<shape> shapes;
+	glm::mat4 player_trans;
+};
+
+// lock-free handoff between one writer and one reader, the writer and the reader
+// each own a buffer and the third one holds the latest published value
+template<class T>
+class triple_buffer
+{
+	static constexpr int fresh = 4; // set when the middle buffer is not read yet
+
+	T m_buffers[3];
+	std::atomic<int> m_middle;
+	int m_write, m_read;
+
+public:
+	triple_buffer() : m_middle(1), m_write(0), m_read(2) {}
+
+	// writer side
+	T& write_buffer() { return m_buffers[m_write]; }
+	void publish() { m_write = m_middle.exchange(m_write | fresh) & ~fresh; }
+
+	// reader side, returns false if nothing was published since the last fetch
+	bool fetch() {
+		if ((m_middle.load() & fresh) == 0) return false;
+		m_read = m_middle.exchange(m_read) & ~fresh;
+		return true;
+	}
+	const T& read_buffer() const { return m_buffers[m_read]; }
+};
+
+// Runs the simulation and the rendering on separate threads. The simulation thread
+// uses this as its renderer and publishes a snapshot at the end of every step, it is
+// paced at a fixed rate. The render thread (the one that created the window) draws
+// the latest snapshot at the display rate.
+class RenderThread : public Renderer
+{
+protected:
+	OpenGLRenderer& m_renderer;
+	std::atomic<bool> m_running;
+
+	//--- simulation thread
+	slot_map<int, glm::mat4, unsigned int> m_scene; // template id, transform and step it changed
+	unsigned int m_steps;
+	glm::mat4 m_player_trans;
+	Controller m_controller;
+	std::chrono::steady_clock::duration m_step;
+	std::chrono::steady_clock::time_point m_next_step;
+
+	//--- shared
+	triple_buffer<scene_snapshot> m_snapshots;
+	// templates are rare, they are queued and created before the snapshot using them
+	std::mutex m_lock;
+	std::vector<std::pair<int, std::string>> m_templates;
+	Controller m_input; // copy of the window controller
+
+	//--- render thread
+	// the shapes sent to the renderer, the last snapshot they were in and the
+	// step of their transform, snapshots can be skipped so a flag would not do
+	slot_map<unsigned int, unsigned int> m_rendered;
+	unsigned int m_frame;
+	void apply_snapshot(const scene_snapshot& scene);
+
+public:
+	// step_rate is the number of simulation steps per second
+	RenderThread(OpenGLRenderer& renderer, float step_rate = 60.f);
+	virtual ~RenderThread() {}
+
+	// called by the render thread, returns when the window is closed
+	void run();
+	bool is_running() const { return m_running; }
+
+	// Renderer responsibilities, called by the simulation thread except for
+	// setup_camera and the connection which happen before the simulation starts
+	virtual int how_many_controllers() { return 1; }
+	virtual Controller& get_controller(int which);
+	virtual void set_player_transform(int which, const glm::mat4& trans) { if (which == 0) m_player_trans = trans; }
+	virtual void setup_camera(bool follow, const glm::vec3& eye, const glm::vec3& target);
+
+	virtual void add_template(int id, const char* desc, size_t size);
+	virtual void add_shape(int id, int template_id, const glm::mat4& trans);
+	virtual void update_shape(int id, const glm::mat4& trans);
+	virtual void remove_shape(int id);
+	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key);
+	virtual void pre_connect();
+	virtual void post_connect();
+	virtual void begin_update() {}
+	virtual bool end_update(float elapsed_time);
+};
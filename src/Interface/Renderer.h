@@ -6,6 +6,7 @@
  */
 #pragma once
 
+#include <cstdint>
 #include <glm/glm.hpp>
 
 class Controller;
@@ -19,10 +20,15 @@ public:
 	virtual void set_player_transform(int which, const glm::mat4& trans) = 0;
 	virtual void setup_camera(bool follow, const glm::vec3& eye, const glm::vec3& target) = 0;
 
-	virtual void add_shape(int id, const char* json) = 0;
+	// a template is a shape (mesh, face index and textures) shared by all 
+	// the shapes added with its id, desc is a binary shape descriptor 
+	// (see shape_desc_header) and its root transform is ignored
+	virtual void add_template(int id, const char* desc, size_t size) = 0;
+	virtual void add_shape(int id, int template_id, const glm::mat4& trans) = 0;
 	virtual void update_shape(int id, const glm::mat4& trans) = 0;
 	virtual void remove_shape(int id) = 0;
-	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data) = 0;
+	// key identifies the image content so it can be cached by the renderer
+	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key) = 0;
 	virtual void pre_connect() = 0;
 	virtual void post_connect() = 0;
 	virtual void begin_update() = 0;
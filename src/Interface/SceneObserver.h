@@ -6,9 +6,12 @@
  */
 #pragma once
 
-#include <map>
-#include <set>
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
 #include "Renderer.h"
+#include "SlotMap.h"
 #include "Shapes.h"
 #include "Controller.h"
 #include "TextureMaps.h"
@@ -16,19 +19,37 @@
 class SceneObserver
 {
 protected:
-	int m_next_shape_id;
-	std::map<int, const Shape*> m_shapes;
-	std::map<int, glm::mat4> m_trans;
+	// the shapes, their transforms and what changed since the last update
+	enum { shape_added = 1, shape_updated = 2 };
+	slot_map<const Shape*, glm::mat4, uint8_t> m_shapes;
+	std::vector<int> m_removed;
 
-	std::set<int> m_add, m_update, m_remove;
+	// identical shapes (track links, projectiles...) share one template
+	// keyed by the hash of the binary descriptor of the shape
+	int m_next_template_id;
+	std::unordered_map<uint64_t, int> m_templates;
 
 	Renderer* m_player;
 	Controller m_controller;
 	glm::mat4 m_player_trans;
 	TextureMap m_TextureMap;
 
+	int get_template(const Shape* shape) {
+		uint64_t key = shape->template_key();
+		auto t = m_templates.find(key);
+		if (t != m_templates.end()) return (*t).second;
+
+		// first shape of its kind
+		int id = m_next_template_id++;
+		std::string desc;
+		shape->to_binary(glm::mat4(1.f), desc);
+		m_player->add_template(id, desc.data(), desc.size());
+		m_templates.insert(std::make_pair(key, id));
+		return id;
+	}
+
 public:
-	SceneObserver() : m_next_shape_id (0), m_player (NULL), m_player_trans() {}
+	SceneObserver() : m_next_template_id (0), m_player (NULL), m_player_trans() {}
 	virtual ~SceneObserver() {}
 
 	TextureMap& get_texture_map() { return m_TextureMap; }
@@ -42,50 +63,63 @@ public:
 	}
 
 	int add_shape(const Shape* shape, const glm::mat4& trans) {
-		m_shapes.insert(std::make_pair(m_next_shape_id, shape));
-		m_trans.insert(std::make_pair(m_next_shape_id, trans));
-		m_add.insert(m_next_shape_id);
-		return m_next_shape_id++;
+		return m_shapes.insert(shape, trans, shape_added);
 	}
 
 	void update_shape(int id, const glm::mat4& trans) {
-		m_trans[id] = trans;
-		m_update.insert(id);
+		int pos = m_shapes.find(id);
+		if (pos < 0) return; // removed already
+		glm::mat4& t = m_shapes.column<1>()[pos];
+		if (t == trans) return; // resting objects are not sent again
+		t = trans;
+		m_shapes.column<2>()[pos] |= shape_updated;
 	}
 
 	void remove_shape(int id) {
-		delete m_shapes[id];
-		m_shapes.erase(id);
-		m_trans.erase(id);
-	
-		if (m_add.find(id) == m_add.end()) {
-			m_remove.insert(id);
-		} else {
-			// shape is added and removed in the same update cycle
-			m_add.erase(id);
+		int pos = m_shapes.find(id);
+		if (pos < 0) return;
+		delete m_shapes.column<0>()[pos];
+		// unless the shape is added and removed in the same update cycle
+		if ((m_shapes.column<2>()[pos] & shape_added) == 0) {
+			m_removed.push_back(id);
 		}
-		m_update.erase(id);
+		m_shapes.erase(id);
 	}
 
 	void connect(Renderer* player) {
 		m_player = player;
+		m_templates.clear(); // the new player has none of the templates
 
 		m_player->pre_connect();
+		m_TextureMap.build(); // in case textures are requested after the scene creation
 		for (auto& i : m_TextureMap.get_image_map()) {
-			m_player->add_texture(i.first, i.second.width, i.second.height, i.second.data);
+			m_player->add_texture(i.first, i.second.width, i.second.height, i.second.data, i.second.key);
 		}
 		m_player->post_connect();
 	}
 	
 	void update() {
+		// removed first since the id of a new shape can reuse the slot of a removed one
 		if (m_player != NULL) {
-			for (int i : m_add) m_player->add_shape(i, (*m_shapes[i]).to_json(m_trans[i]).c_str());
-			for (int i : m_update) m_player->update_shape(i, m_trans[i]);
-			for (int i : m_remove) m_player->remove_shape(i);
+			for (int i : m_removed) m_player->remove_shape(i);
+		}
+		m_removed.clear();
+
+		const std::vector<int>& ids = m_shapes.ids();
+		std::vector<const Shape*>& shapes = m_shapes.column<0>();
+		std::vector<glm::mat4>& trans = m_shapes.column<1>();
+		std::vector<uint8_t>& flags = m_shapes.column<2>();
+		for (size_t i = 0; i < ids.size(); i++) {
+			if (flags[i] == 0) continue;
+			if (m_player != NULL) {
+				if (flags[i] & shape_added) {
+					m_player->add_shape(ids[i], get_template(shapes[i]), trans[i]);
+				} else {
+					m_player->update_shape(ids[i], trans[i]);
+				}
+			}
+			flags[i] = 0;
 		}
-		m_add.clear();
-		m_update.clear();
-		m_remove.clear();
 	}
 
 	Controller& get_controller(int which) {
@@ -37,17 +37,19 @@ unsigned int setupShaderProgram()
 		layout(location = 0) in vec3 pos;
 		layout(location = 1) in vec2 t;
 		layout(location = 2) in vec3 n;
+		// per-instance model transform and its normal matrix
+		layout(location = 3) in mat4 model;
+		layout(location = 7) in mat3 normal_matrix;
 
 		out vec3 normal;
 		out vec2 txtr_pos;
 
-		uniform mat4 model;
 		uniform mat4 view;
 		uniform mat4 projection;
 
 		void main()
 		{
-			normal = mat3(transpose(inverse(model))) * n;
+			normal = normal_matrix * n;
 			txtr_pos = t;
 			gl_Position = projection * view * model * vec4(pos, 1.0);
 		}
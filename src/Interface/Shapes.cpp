@@ -5,6 +5,7 @@
  * found in the LICENSE file at the top of the source tree
  */
 #include <vector>
+#include <algorithm>
 #include <glad/gl.h>
 #include <glm/gtc/matrix_transform.hpp>
 #include "Shapes.h"
@@ -49,7 +50,20 @@ std::string Shape::to_json(const glm::mat4& trans) const
 		first = false;
 	}
 
-	json += "],\"face_index\":[";
+	json += "],";
+
+	if (m_indices.size() > 0) {
+		json += "\"indices\":[";
+		first = true;
+		for (auto& i : m_indices) {
+			if (!first) json += ",";
+			json += std::to_string(i);
+			first = false;
+		}
+		json += "],";
+	}
+
+	json += "\"face_index\":[";
 	first = true;
 	for (auto& i : m_face_index) {
 		if (!first) json += ",";
@@ -76,10 +90,75 @@ std::string Shape::to_json(const glm::mat4& trans) const
 	return std::move(json);
 }
 
+void Shape::to_binary(const glm::mat4& trans, std::string& desc) const
+{
+	shape_desc_header header;
+	header.num_children = 0;
+	header.num_vertices = (uint32_t)m_mesh.size();
+	header.num_indices = (uint32_t)m_indices.size();
+	header.num_faces = (uint32_t)m_face_index.size();
+	header.default_texture = m_default_texture;
+	header.num_textures = (uint32_t)m_textures.size();
+	header.num_lods = (uint32_t)m_lods.size();
+	memcpy(header.trans, &trans[0][0], sizeof(header.trans));
+
+	desc.reserve(desc.size() + sizeof(header) + m_mesh.size() * sizeof(uv_vertex) + 
+				 (m_indices.size() + m_face_index.size() + m_textures.size()) * sizeof(uint32_t));
+	desc.append((const char*)&header, sizeof(header));
+	desc.append((const char*)m_mesh.data(), m_mesh.size() * sizeof(uv_vertex));
+	desc.append((const char*)m_indices.data(), m_indices.size() * sizeof(uint32_t));
+	desc.append((const char*)m_face_index.data(), m_face_index.size() * sizeof(int));
+	desc.append((const char*)m_textures.data(), m_textures.size() * sizeof(unsigned int));
+	for (const lod& l : m_lods) {
+		lod_desc_header lod_header;
+		lod_header.distance = l.distance;
+		lod_header.num_vertices = (uint32_t)l.mesh.size();
+		lod_header.num_indices = (uint32_t)l.indices.size();
+		lod_header.num_faces = (uint32_t)l.face_index.size();
+		desc.append((const char*)&lod_header, sizeof(lod_header));
+		desc.append((const char*)l.mesh.data(), l.mesh.size() * sizeof(uv_vertex));
+		desc.append((const char*)l.indices.data(), l.indices.size() * sizeof(uint32_t));
+		desc.append((const char*)l.face_index.data(), l.face_index.size() * sizeof(int));
+	}
+}
+
+uint64_t Shape::template_key() const
+{
+	if (m_template_key != 0) return m_template_key;
+	std::string desc;
+	to_binary(glm::mat4(1.f), desc);
+	// FNV-1a
+	uint64_t hash = 0xcbf29ce484222325ull;
+	for (unsigned char c : desc) {
+		hash ^= c;
+		hash *= 0x100000001b3ull;
+	}
+	m_template_key = (hash != 0) ? hash : 1;
+	return m_template_key;
+}
+
+void CompoundShape::to_binary(const glm::mat4& trans, std::string& desc) const
+{	// a compound shape has no mesh of its own
+	shape_desc_header header;
+	header.num_children = (uint32_t)m_child_shapes.size();
+	header.num_vertices = 0;
+	header.num_indices = 0;
+	header.num_faces = 0;
+	header.default_texture = 0;
+	header.num_textures = 0;
+	header.num_lods = 0;
+	memcpy(header.trans, &trans[0][0], sizeof(header.trans));
+	desc.append((const char*)&header, sizeof(header));
+	for (const child_shape& child : m_child_shapes) {
+		child.shape->to_binary(child.trans, desc);
+	}
+}
+
 void CompoundShape::add_child_shape(Shape* shape, const glm::mat4& trans)
 {
 	child_shape child = { shape, trans };
 	m_child_shapes.push_back(child);
+	m_template_key = 0; // the mesh has changed
 }
 
 void CompoundShape::add_child_shape(Shape* child, const glm::vec3& origin, const glm::vec3& rotation, float angle)
@@ -101,10 +180,47 @@ void CompoundShape::set_texture(unsigned int texture)
 	}
 }
 
-void SphereShape::create_mesh()
+//~~~
+// Levels of detail
+//~~~
+void Shape::create_lods(float radius, float quality, const std::function<void(int)>& create_mesh)
+{	// the steps divide 90 degrees so the capsule still has its equator
+	const int steps[] = { 5, 6, 9, 10, 15, 18, 30, 45 };
+	const int num_steps = sizeof(steps) / sizeof(int);
+	// how far a straight edge is from the curve at the given step
+	auto error = [radius](int step) { return radius * (1.f - glm::cos(glm::radians(step / 2.f))); };
+	// the finest level keeps the error within 5 mm (at quality 1)
+	// and a coarser level is used when its error is within 
+	// 2 milliradians as seen from the camera
+	float max_error = 0.005f / quality;
+	float max_angle = 0.002f / quality;
+
+	int level = 0;
+	while (level < num_steps - 1 && error(steps[level + 1]) <= max_error) level++;
+	std::vector<int> levels = { level };
+	while (level < num_steps - 1) {
+		// each level has about half the vertices around the curve
+		int next = level;
+		while (next < num_steps - 1 && steps[next] < steps[level] * 2) next++;
+		levels.push_back(level = next);
+	}
+
+	// coarser levels first, the finest one is the mesh of the shape
+	for (size_t i = levels.size() - 1; i > 0; i--) {
+		create_mesh(steps[levels[i]]);
+		lod l = { error(steps[levels[i]]) / max_angle, 
+				  std::move(m_mesh), std::move(m_indices), std::move(m_face_index) };
+		m_lods.insert(m_lods.begin(), std::move(l));
+		m_mesh.clear();
+		m_indices.clear();
+		m_face_index.clear();
+	}
+	create_mesh(steps[levels[0]]);
+}
+
+void SphereShape::create_mesh(int step)
 {	// create vertices/triangles for a UV-sphere
-	int step = 10;
-	std::vector<uv_vertex> vertices;
+	// the triangles share the vertices of the latitude/longitude grid
 	for (int u = 0; u <= 180; u += step) {
 		for (int v = 0; v <= 360; v += step) {
 
@@ -117,36 +233,26 @@ void SphereShape::create_mesh()
 			uv.y = m_radius * glm::sin(latitude);
 			uv.texture_x = (float)v / 360.f;
 			uv.texture_y = (float)u / 180.f;
-			vertices.push_back(uv);
+			m_mesh.push_back(uv);
 		}
 	}
 
-	int nlat = (180 / step) + 1;
-	int nlon = (360 / step) + 1;
-	uv_vertex* line = vertices.data();
-	uv_vertex* next_line = line + nlon;
-	for (int u = 0; u < (nlat - 1); u += 1) {
-		for (int v = 0; v < (nlon - 1); v += 1) {
-
-			m_mesh.push_back(line[v]);
-			m_mesh.push_back(next_line[v]);
-			m_mesh.push_back(next_line[v + 1]);
-
-			m_mesh.push_back(line[v]);
-			m_mesh.push_back(next_line[v + 1]);
-			m_mesh.push_back(line[v + 1]);
+	uint32_t nlat = (180 / step) + 1;
+	uint32_t nlon = (360 / step) + 1;
+	for (uint32_t u = 0; u < (nlat - 1); u += 1) {
+		uint32_t line = u * nlon;
+		uint32_t next_line = line + nlon;
+		for (uint32_t v = 0; v < (nlon - 1); v += 1) {
+			add_quad(line + v, next_line + v, next_line + v + 1, line + v + 1);
 		}
-		line += nlon;
-		next_line += nlon;
 	}
 	m_face_index.push_back(0);
 }
 
 // In texture coordinates, (0, 0) is the bottom left, (1, 1) the top right
-void CapsuleShape::create_mesh()
+void CapsuleShape::create_mesh(int step)
 {	// total height = height + 2 * radius
-	int step = 10;
-	std::vector<uv_vertex> vertices;
+	// the triangles share the vertices of the latitude/longitude grid
 	float texture_offset = 0;
 	for (int u = 0; u <= 180; u += step) {
 		
@@ -164,7 +270,7 @@ void CapsuleShape::create_mesh()
 			uv.x = m_radius * glm::cos(latitude) * glm::cos(longitude);
 			uv.z = m_radius * glm::cos(latitude) * glm::sin(longitude);
 			uv.texture_x = (float)v / 360.f;
-			vertices.push_back(uv);
+			m_mesh.push_back(uv);
 		}
 		debug_log_mute("capsule latitude: %f y: %f texture_y: %f offset: %f\n", latitude, uv.y, texture_y, offset);
 
@@ -184,35 +290,27 @@ void CapsuleShape::create_mesh()
 				uv.x = m_radius * glm::cos(latitude) * glm::cos(longitude);
 				uv.z = m_radius * glm::cos(latitude) * glm::sin(longitude);
 				uv.texture_x = (float)v / 360.f;
-				vertices.push_back(uv);
+				m_mesh.push_back(uv);
 			}
 		}
 	}
 
-	int nlat = (180 / step) + 2;
-	int nlon = (360 / step) + 1;
-	uv_vertex* line = vertices.data();
-	uv_vertex* next_line = line + nlon;
-	for (int u = 0; u < (nlat - 1); u += 1) {
-		for (int v = 0; v < (nlon - 1); v += 1) {
-
-			m_mesh.push_back(line[v]);
-			m_mesh.push_back(next_line[v]);
-			m_mesh.push_back(next_line[v + 1]);
-
-			m_mesh.push_back(line[v]);
-			m_mesh.push_back(next_line[v + 1]);
-			m_mesh.push_back(line[v + 1]);
+	uint32_t nlat = (180 / step) + 2;
+	uint32_t nlon = (360 / step) + 1;
+	for (uint32_t u = 0; u < (nlat - 1); u += 1) {
+		uint32_t line = u * nlon;
+		uint32_t next_line = line + nlon;
+		for (uint32_t v = 0; v < (nlon - 1); v += 1) {
+			add_quad(line + v, next_line + v, next_line + v + 1, line + v + 1);
 		}
-		line += nlon;
-		next_line += nlon;
 	}
 	m_face_index.push_back(0);
 }
 
-void CylinderShape::create_mesh()
+void CylinderShape::create_mesh(int step)
 {	// a cylinder along the Y-axis centered at (0, 0, 0)
-	int step = 10;
+	// the top, side and bottom faces each have their own vertices
+	// so the normals are only smoothed around the side
 	std::vector<uv_vertex> vertices;
 	for (int u = 0; u <= 360; u += step) {
 		float angle = glm::radians((float)u);
@@ -228,71 +326,56 @@ void CylinderShape::create_mesh()
 		uv.texture_y = 0.5f + cosine / 2.f;;
 		vertices.push_back(uv);
 	}
-
-	// top mesh
-	uv_vertex* data = vertices.data();
-	m_face_index.push_back((int)m_mesh.size());
-	uv_vertex center = { 0.f, m_half_height, 0.f, 0.5f, 0.5f };
-	for (int i = 0; i < vertices.size() - 1; i++) {
-		m_mesh.push_back(center);
-		m_mesh.push_back(data[i]);
-		m_mesh.push_back(data[i + 1]);
+	uint32_t n = (uint32_t)vertices.size() - 1;
+
+	// top mesh: center followed by the rim
+	m_face_index.push_back((int)m_indices.size());
+	uint32_t center = (uint32_t)m_mesh.size();
+	m_mesh.push_back({ 0.f, m_half_height, 0.f, 0.5f, 0.5f });
+	m_mesh.insert(m_mesh.end(), vertices.begin(), vertices.end());
+	for (uint32_t i = 0; i < n; i++) {
+		m_indices.insert(m_indices.end(), { center, center + 1 + i, center + 2 + i });
 	}
 
-	// side mesh
-	m_face_index.push_back((int)m_mesh.size());
-	int n = (int)vertices.size() - 1;
-	for (int i = 0; i < n; i++) {
-
-		float x1 = (float)i / (float)n;
-		float x2 = (float)(i + 1) / (float)n;
-		uv_vertex a1 = data[i];
-		a1.texture_x = x1;
-		a1.texture_y = 0.f;
-
-		uv_vertex b1 = a1;
-		b1.y = -m_half_height;
-		b1.texture_x = x1;
-		b1.texture_y = 1.f;
-
-		uv_vertex a2 = data[i + 1];
-		a2.texture_x = x2;
-		a2.texture_y = 0.f;
-
-		uv_vertex b2 = a2;
-		b2.y = -m_half_height;
-		b2.texture_x = x2;
-		b2.texture_y = 1.f;
-
-		m_mesh.push_back(a1);
-		m_mesh.push_back(b1);
-		m_mesh.push_back(a2);
-
-		m_mesh.push_back(b1);
-		m_mesh.push_back(b2);
-		m_mesh.push_back(a2);
+	// side mesh: top and bottom vertex pairs 
+	m_face_index.push_back((int)m_indices.size());
+	uint32_t side = (uint32_t)m_mesh.size();
+	for (uint32_t i = 0; i <= n; i++) {
+		float x = (float)i / (float)n;
+		uv_vertex a = vertices[i];
+		a.texture_x = x;
+		a.texture_y = 0.f;
+
+		uv_vertex b = a;
+		b.y = -m_half_height;
+		b.texture_y = 1.f;
+
+		m_mesh.push_back(a);
+		m_mesh.push_back(b);
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		uint32_t a1 = side + i * 2, b1 = a1 + 1;
+		uint32_t a2 = a1 + 2, b2 = a1 + 3;
+		m_indices.insert(m_indices.end(), { a1, b1, a2, b1, b2, a2 });
 	}
 
-	// bottom mesh
-	m_face_index.push_back((int)m_mesh.size());
-	center.y = -m_half_height;
-	for (int i = 0; i < vertices.size() - 1; i++) {
-
-		uv_vertex b1 = data[i];
-		b1.y = -m_half_height;
-
-		uv_vertex b2 = data[i + 1];
-		b2.y = -m_half_height;
-
-		m_mesh.push_back(center);
-		m_mesh.push_back(b2);
-		m_mesh.push_back(b1);
+	// bottom mesh: center followed by the rim
+	m_face_index.push_back((int)m_indices.size());
+	center = (uint32_t)m_mesh.size();
+	m_mesh.push_back({ 0.f, -m_half_height, 0.f, 0.5f, 0.5f });
+	for (uv_vertex uv : vertices) {
+		uv.y = -m_half_height;
+		m_mesh.push_back(uv);
+	}
+	for (uint32_t i = 0; i < n; i++) {
+		m_indices.insert(m_indices.end(), { center, center + 2 + i, center + 1 + i });
 	}
 }
 
-void ConeShape::create_mesh()
+void ConeShape::create_mesh(int step)
 {	// a cone along the Y-axis centered at (0, 0, 0) 
-	int step = 10;
+	// the slope shares the vertices around the rim but each triangle 
+	// has its own tip so the normals point away from the slope
 	float halfHeight = m_height / 2.f;
 	std::vector<uv_vertex> vertices;
 	for (int u = 0; u <= 360; u += step) {
@@ -309,26 +392,24 @@ void ConeShape::create_mesh()
 		uv.texture_y = 0.5f + cosine / 2.f;;
 		vertices.push_back(uv);
 	}
+	uint32_t n = (uint32_t)vertices.size() - 1;
 
-	// side (slope) mesh
-	uv_vertex* data = vertices.data();
-	uv_vertex center = { 0.f, halfHeight, 0.f, 0.5f, 0.5f };
-	for (int i = 0; i < vertices.size() - 1; i++) {
-		m_mesh.push_back(center);
-		m_mesh.push_back(data[i]);
-		m_mesh.push_back(data[i + 1]);
+	// side (slope) mesh: the rim followed by the tips
+	m_face_index.push_back(0);
+	m_mesh.insert(m_mesh.end(), vertices.begin(), vertices.end());
+	uint32_t tip = (uint32_t)m_mesh.size();
+	for (uint32_t i = 0; i < n; i++) {
+		m_mesh.push_back({ 0.f, halfHeight, 0.f, 0.5f, 0.5f });
+		m_indices.insert(m_indices.end(), { tip + i, i, i + 1 });
 	}
 	
-	m_face_index.push_back(0);
-	m_face_index.push_back((int)m_mesh.size());
-
-	// bottom mesh
-	data = vertices.data();
-	center.y = -halfHeight;
-	for (int i = 0; i < vertices.size() - 1; i++) {
-		m_mesh.push_back(center);
-		m_mesh.push_back(data[i + 1]);
-		m_mesh.push_back(data[i]);
+	// bottom mesh: center followed by the rim
+	m_face_index.push_back((int)m_indices.size());
+	uint32_t center = (uint32_t)m_mesh.size();
+	m_mesh.push_back({ 0.f, -halfHeight, 0.f, 0.5f, 0.5f });
+	m_mesh.insert(m_mesh.end(), vertices.begin(), vertices.end());
+	for (uint32_t i = 0; i < n; i++) {
+		m_indices.insert(m_indices.end(), { center, center + 2 + i, center + 1 + i });
 	}
 }
 
@@ -409,7 +490,7 @@ void BoxShape::create_mesh()
 }
 
 //~~~
-// GroundShape can be either static plane or height field terrain
+// GroundShape is a static plane
 //~~~
 void GroundShape::create_mesh()
 {
@@ -435,13 +516,210 @@ void GroundShape::create_mesh()
 	m_mesh.push_back(vertices[3]);
 }
 
-Shape* CreateGearShape(float radius, float half_thickness, int num_teeth, float tooth_half_width)
+//~~~
+// HeightfieldShape
+//~~~
+
+// a square of cells of the height field, its origin is at the center of the 
+// square halfway between its lowest and highest points so the level of detail 
+// follows the distance to the surface
+class HeightfieldChunk : public Shape
+{
+protected:
+	const HeightfieldShape& m_field;
+	int m_column, m_row;	// first sample of the chunk
+	int m_cells_x, m_cells_z;
+	glm::vec3 m_center;
+	float m_skirt;			// depth of the skirts that hide the cracks to the neighbours
+	
+	float height(int i, int j) const { 
+		return m_field.heights()[(size_t)(m_row + j) * m_field.columns() + m_column + i]; 
+	}
+	// the samples used at a step, the last one is always kept so the edges match
+	static std::vector<int> samples(int cells, int step) {
+		std::vector<int> v;
+		for (int i = 0; i < cells; i += step) v.push_back(i);
+		v.push_back(cells);
+		return v;
+	}
+	float error(int step) const;
+	void create_mesh(int step);
+
+public:
+	HeightfieldChunk(const HeightfieldShape& field, int column, int row, int cells_x, int cells_z, float quality);
+	virtual ~HeightfieldChunk() {}
+	const glm::vec3& center() const { return m_center; }
+};
+
+HeightfieldChunk::HeightfieldChunk(const HeightfieldShape& field, int column, int row, int cells_x, int cells_z, float quality) :
+	m_field(field), m_column(column), m_row(row), m_cells_x(cells_x), m_cells_z(cells_z)
+{
+	m_type = Type::Heightfield;
+	float dx = field.param()[0] / (field.columns() - 1);
+	float dz = field.param()[1] / (field.rows() - 1);
+	m_center = glm::vec3((column + cells_x * .5f) * dx - field.param()[0] * .5f, 0.f,
+						 (row + cells_z * .5f) * dz - field.param()[1] * .5f);
+	float lo = height(0, 0), hi = lo;
+	for (int j = 0; j <= m_cells_z; j++) {
+		for (int i = 0; i <= m_cells_x; i++) {
+			lo = std::min(lo, height(i, j));
+			hi = std::max(hi, height(i, j));
+		}
+	}
+	m_center.y = (lo + hi) * .5f;
+	// a crack is never deeper than the heights in the chunk
+	m_skirt = hi - lo + std::min(dx, dz);
+
+	// a coarser level is used when its error is within
+	// 2 milliradians as seen from the camera, as for the curved shapes
+	float max_angle = 0.002f / quality;
+	std::vector<std::pair<int, float>> levels = { { 1, 0.f } };
+	float max_error = 0.f;
+	for (int step = 2; step < std::max(m_cells_x, m_cells_z) * 2; step *= 2) {
+		max_error = std::max(max_error, error(step));
+		float distance = max_error / max_angle;
+		// a finer level that is never closer than this one is useless
+		while (!levels.empty() && levels.back().second >= distance) levels.pop_back();
+		levels.push_back({ step, levels.empty() ? 0.f : distance });
+	}
+
+	// coarser levels first, the finest one is the mesh of the shape
+	for (size_t i = levels.size() - 1; i > 0; i--) {
+		create_mesh(levels[i].first);
+		lod l = { levels[i].second, std::move(m_mesh), std::move(m_indices), std::move(m_face_index) };
+		m_lods.insert(m_lods.begin(), std::move(l));
+		m_mesh.clear();
+		m_indices.clear();
+		m_face_index.clear();
+	}
+	create_mesh(levels[0].first);
+}
+
+float HeightfieldChunk::error(int step) const
+{	// the largest height difference to the coarser grid, interpolated bilinearly
+	std::vector<int> xs = samples(m_cells_x, step);
+	std::vector<int> zs = samples(m_cells_z, step);
+	float e = 0.f;
+	for (size_t b = 0; b + 1 < zs.size(); b++) {
+		for (size_t a = 0; a + 1 < xs.size(); a++) {
+			int i0 = xs[a], i1 = xs[a + 1], j0 = zs[b], j1 = zs[b + 1];
+			for (int j = j0; j <= j1; j++) {
+				float v = (float)(j - j0) / (j1 - j0);
+				for (int i = i0; i <= i1; i++) {
+					float u = (float)(i - i0) / (i1 - i0);
+					float h = glm::mix(glm::mix(height(i0, j0), height(i1, j0), u),
+									   glm::mix(height(i0, j1), height(i1, j1), u), v);
+					e = std::max(e, glm::abs(h - height(i, j)));
+				}
+			}
+		}
+	}
+	return e;
+}
+
+void HeightfieldChunk::create_mesh(int step)
+{	// the triangles share the vertices of the grid and are split like 
+	// the triangles of btHeightfieldTerrainShape at the finest level
+	float width = m_field.param()[0], length = m_field.param()[1];
+	float dx = width / (m_field.columns() - 1);
+	float dz = length / (m_field.rows() - 1);
+	std::vector<int> xs = samples(m_cells_x, step);
+	std::vector<int> zs = samples(m_cells_z, step);
+	auto vertex = [&](int i, int j, float drop) {
+		uv_vertex uv;
+		uv.x = (m_column + i) * dx - width * .5f - m_center.x;
+		uv.y = height(i, j) - drop - m_center.y;
+		uv.z = (m_row + j) * dz - length * .5f - m_center.z;
+		// a texture image of the whole field lines up with a height map image
+		uv.texture_x = (float)(m_column + i) / (m_field.columns() - 1);
+		uv.texture_y = 1.f - (float)(m_row + j) / (m_field.rows() - 1);
+		return uv;
+	};
+	uint32_t nx = (uint32_t)xs.size();
+	for (int j : zs) {
+		for (int i : xs) m_mesh.push_back(vertex(i, j, 0.f));
+	}
+	for (uint32_t b = 0; b + 1 < zs.size(); b++) {
+		for (uint32_t a = 0; a + 1 < nx; a++) {
+			uint32_t v = b * nx + a;
+			add_quad(v + 1, v, v + nx, v + nx + 1);
+		}
+	}
+
+	// the skirts hang from the edges with their own vertices so 
+	// they do not bend the normals of the surface
+	auto skirt = [&](const std::vector<std::pair<int, int>>& edge) {
+		uint32_t first = (uint32_t)m_mesh.size();
+		for (const auto& e : edge) {
+			m_mesh.push_back(vertex(e.first, e.second, 0.f));
+			m_mesh.push_back(vertex(e.first, e.second, m_skirt));
+		}
+		for (uint32_t k = 0; k + 1 < edge.size(); k++) {
+			uint32_t v = first + k * 2;
+			add_quad(v, v + 1, v + 3, v + 2);
+		}
+	};
+	std::vector<std::pair<int, int>> near_edge, far_edge, left_edge, right_edge;
+	for (int i : xs) {
+		near_edge.push_back({ i, 0 });
+		far_edge.push_back({ i, m_cells_z });
+	}
+	for (int j : zs) {
+		left_edge.push_back({ 0, j });
+		right_edge.push_back({ m_cells_x, j });
+	}
+	skirt(near_edge);
+	skirt(far_edge);
+	skirt(left_edge);
+	skirt(right_edge);
+	m_face_index.push_back(0);
+}
+
+HeightfieldShape::HeightfieldShape(float width, float length, int columns, int rows, 
+								   std::vector<float>&& heights, int chunk_size, float quality) :
+	m_width(m_param[0]), m_length(m_param[1]), m_columns(columns), m_rows(rows), 
+	m_heights(std::move(heights))
+{
+	m_type = Type::Heightfield;
+	m_width = width;
+	m_length = length;
+	auto range = std::minmax_element(m_heights.begin(), m_heights.end());
+	m_min_height = *range.first;
+	m_max_height = *range.second;
+	create_chunks(chunk_size, quality);
+}
+
+HeightfieldShape::~HeightfieldShape()
+{	// the chunks are made by this shape
+	for (child_shape& child : m_child_shapes) delete child.shape;
+}
+
+void HeightfieldShape::create_chunks(int chunk_size, float quality)
+{
+	for (int row = 0; row < m_rows - 1; row += chunk_size) {
+		for (int column = 0; column < m_columns - 1; column += chunk_size) {
+			HeightfieldChunk* chunk = new HeightfieldChunk(*this, column, row, 
+				std::min(chunk_size, m_columns - 1 - column), std::min(chunk_size, m_rows - 1 - row), quality);
+			add_child_shape(chunk, glm::translate(glm::mat4(1.f), chunk->center()));
+		}
+	}
+}
+
+void HeightfieldShape::add_texture(unsigned int texture, int repeat)
+{
+	Shape::add_texture(texture, repeat);
+	for (child_shape& child : m_child_shapes) {
+		child.shape->add_texture(texture, repeat);
+	}
+}
+
+Shape* CreateGearShape(float radius, float half_thickness, int num_teeth, float tooth_half_width, float quality)
 {
 	if (tooth_half_width == 0.f) {
 		tooth_half_width = radius * glm::sin(glm::radians(360.f / (2.f * num_teeth))) * .5f;
 	}
 	CompoundShape* gear_shape = new CompoundShape();
-	CylinderShape* disk = new CylinderShape (radius, half_thickness);
+	CylinderShape* disk = new CylinderShape (radius, half_thickness, quality);
 	disk->set_texture(gear_shape->get_default_texture());
 	gear_shape->add_child_shape(disk, glm::mat4(1.f));
 
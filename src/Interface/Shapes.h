@@ -8,6 +8,8 @@
 
 #include <vector>
 #include <string>
+#include <cstdint>
+#include <functional>
 #include <glm/glm.hpp>
 #include "TextureMaps.h"
 
@@ -20,11 +22,44 @@ struct uv_vertex
 	float texture_y;
 };
 
+//~~~
+// Binary shape descriptor sent to the renderers:
+// the header followed by 
+//	* uv_vertex mesh[num_vertices]
+//	* uint32_t indices[num_indices]
+//	* int32_t face_index[num_faces]
+//	* uint32_t textures[num_textures]
+//	* coarser levels of detail, each one is a lod_desc_header followed by
+//	  its own mesh, indices and face_index (the textures are shared)
+//	* binary descriptors of the child shapes (compound shape only)
+// all numbers are little-endian
+//~~~
+struct shape_desc_header
+{
+	uint32_t num_children;
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t num_faces;
+	uint32_t default_texture;
+	uint32_t num_textures;
+	uint32_t num_lods;
+	float trans[16];
+};
+
+struct lod_desc_header
+{
+	float distance; // the level is used from this distance to the camera
+	uint32_t num_vertices;
+	uint32_t num_indices;
+	uint32_t num_faces;
+};
+
 class Shape
 {
 public:
 	enum class Type {
 		Ground,
+		Heightfield,
 		Box,
 		Sphere,
 		Cylinder,
@@ -33,18 +68,35 @@ public:
 		Convex,
 		Compound
 	};
+	// a coarser level of detail of the shape
+	struct lod {
+		float distance;
+		std::vector<uv_vertex> mesh;
+		std::vector<uint32_t> indices;
+		std::vector<int> face_index;
+	};
+
 	virtual ~Shape() {}
-	virtual void set_texture(unsigned int texture) { m_default_texture = texture; }
+	virtual void set_texture(unsigned int texture) { m_default_texture = texture; m_template_key = 0; }
 	virtual void add_texture(unsigned int texture, int repeat = 1) {
 		while (repeat-- > 0) m_textures.push_back(texture); 
+		m_template_key = 0;
 	}
 	
 	unsigned int get_default_texture() const { return m_default_texture; }
 	Type get_type() const { return m_type; }
 	const float* param() const { return m_param; }	
 	const std::vector<uv_vertex>& mesh() const { return m_mesh; }
+	const std::vector<uint32_t>& indices() const { return m_indices; }
 	const std::vector<int>& face_index() const { return m_face_index; }
+	const std::vector<lod>& lods() const { return m_lods; }
+	// binary descriptor is appended to desc
+	virtual void to_binary(const glm::mat4& trans, std::string& desc) const;
+	// for debugging only
 	virtual std::string to_json(const glm::mat4& trans) const;
+	// hash of the binary descriptor, identical shapes share a template by this key
+	// it is computed once and kept by the copies of the shape
+	uint64_t template_key() const;
 
 protected:
 	Type m_type;
@@ -52,14 +104,34 @@ protected:
 	// mesh is the sequence of vertices that form triangles of the shape
 	// plus the texture coordinates
 	std::vector<uv_vertex> m_mesh;
-	// indices into the mesh that mark beginning of a face of the shape
+	// for an indexed mesh, every 3 indices into the mesh form a triangle
+	// so the triangles can share vertices (and smooth normals)
+	// otherwise it is empty and every 3 vertices form a triangle
+	std::vector<uint32_t> m_indices;
+	// indices into the mesh (or m_indices for an indexed mesh) that mark 
+	// beginning of a face of the shape
 	// each face of the shape gets its own texture map
 	std::vector<int> m_face_index;
 
+	// adds the 2 triangles of the quad a-b-c-d to an indexed mesh
+	void add_quad(uint32_t a, uint32_t b, uint32_t c, uint32_t d) {
+		m_indices.insert(m_indices.end(), { a, b, c, a, c, d });
+	}
+
+	// the finest level is the mesh above, coarser levels follow
+	std::vector<lod> m_lods;
+	// creates the levels of detail of a curved shape with create_mesh(step)
+	// where step is the angle in degrees between the vertices around 
+	// the curve, the steps are chosen from the radius of the curve
+	// a higher quality makes finer meshes and keeps them until 
+	// farther from the camera, each scene has its own (1 by default)
+	void create_lods(float radius, float quality, const std::function<void(int)>& create_mesh);
+
 	unsigned int m_default_texture; // a (default) texture for all faces
 	std::vector<unsigned int> m_textures;
+	mutable uint64_t m_template_key; // 0 until it is needed
 
-	Shape() : m_param{0.f}, m_default_texture(0) {}
+	Shape() : m_param{0.f}, m_default_texture(0), m_template_key(0) {}
 };
 
 class CompoundShape : public Shape
@@ -80,6 +152,7 @@ public:
 	void add_child_shape(Shape* child, const glm::mat4& trans);
 	void add_child_shape(Shape* child, const glm::vec3& origin, const glm::vec3& rotation, float angle);
 	const std::vector<child_shape>& get_child_shapes() const { return m_child_shapes; }
+	virtual void to_binary(const glm::mat4& trans, std::string& desc) const;
 	virtual std::string to_json(const glm::mat4& trans) const;
 };
 
@@ -89,14 +162,15 @@ protected:
 	float& m_radius;
 
 public:
-	SphereShape(float radius) : m_radius(m_param[0])
+	SphereShape(float radius, float quality = 1.f) : m_radius(m_param[0])
 	{
 		m_type = Type::Sphere;
 		m_radius = radius;
-		create_mesh();
+		create_lods(m_radius, quality, [this](int step) { create_mesh(step); });
 	}
+	SphereShape(const SphereShape& other) : Shape(other), m_radius(m_param[0]) {}
 	virtual ~SphereShape() {}
-	virtual void create_mesh();
+	virtual void create_mesh(int step);
 	float radius() const { return m_radius; }
 };
 
@@ -105,17 +179,19 @@ class CapsuleShape : public Shape
 protected:
 	float& m_radius;
 	float& m_height;
-	void create_mesh();
+	void create_mesh(int step);
 
 public:
-	CapsuleShape(float radius, float height) : 
+	CapsuleShape(float radius, float height, float quality = 1.f) : 
 		m_radius(m_param[0]), m_height(m_param[1])
 	{
 		m_type = Type::Capsule;
 		m_radius = radius;
 		m_height = height;
-		create_mesh();
+		create_lods(m_radius, quality, [this](int step) { create_mesh(step); });
 	}
+	CapsuleShape(const CapsuleShape& other) : 
+		Shape(other), m_radius(m_param[0]), m_height(m_param[1]) {}
 	virtual ~CapsuleShape() {}
 	float radius() const { return m_radius; }
 	float height() const { return m_height; }
@@ -126,16 +202,16 @@ class CylinderShape : public Shape
 protected:
 	float& m_radius;
 	float& m_half_height;
-	void create_mesh();
+	void create_mesh(int step);
 
 public:
-	CylinderShape(float radius, float half_height) :
+	CylinderShape(float radius, float half_height, float quality = 1.f) :
 		m_radius(m_param[0]), m_half_height(m_param[1])
 	{
 		m_type = Type::Cylinder;
 		m_radius = radius;
 		m_half_height = half_height;
-		create_mesh();
+		create_lods(m_radius, quality, [this](int step) { create_mesh(step); });
 	}
 	virtual ~CylinderShape() {}
 };
@@ -145,16 +221,16 @@ class ConeShape : public Shape
 protected:
 	float& m_radius;
 	float& m_height;
-	void create_mesh();
+	void create_mesh(int step);
 
 public:
-	ConeShape(float radius, float height) :
+	ConeShape(float radius, float height, float quality = 1.f) :
 		m_radius(m_param[0]), m_height(m_param[1])
 	{
 		m_type = Type::Cone;
 		m_radius = radius;
 		m_height = height;
-		create_mesh();
+		create_lods(m_radius, quality, [this](int step) { create_mesh(step); });
 	}
 	virtual ~ConeShape() {}
 };
@@ -181,14 +257,13 @@ public:
 };
 
 class GroundShape : public Shape
-{	// can be a static plane or height field terrain shape
+{	// a static plane, see HeightfieldShape for terrain
 protected:
 	float& m_width;
 	float& m_length;
 	void create_mesh();
 
 public:
-	// static plane or height field terrain
 	GroundShape(float width, float length) :
 		m_width(m_param[0]), m_length(m_param[1])
 	{
@@ -200,6 +275,34 @@ public:
 	virtual ~GroundShape() {}
 };
 
+// Height field terrain centered at its origin, the samples are spaced evenly 
+// over width (x) by length (z) and a sample of 0 is at the origin's height.
+// It is one collision shape while the render mesh is split into square chunks
+// of chunk_size cells, each one culled and given levels of detail on its own.
+class HeightfieldShape : public CompoundShape
+{
+protected:
+	float& m_width;
+	float& m_length;
+	int m_columns, m_rows;			// samples along x and z
+	std::vector<float> m_heights;	// row by row from -z, each row from -x
+	float m_min_height, m_max_height;
+	void create_chunks(int chunk_size, float quality);
+
+public:
+	HeightfieldShape(float width, float length, int columns, int rows, 
+					 std::vector<float>&& heights, int chunk_size = 32, float quality = 1.f);
+	virtual ~HeightfieldShape();
+	// every chunk has one face
+	virtual void add_texture(unsigned int texture, int repeat = 1);
+
+	int columns() const { return m_columns; }
+	int rows() const { return m_rows; }
+	const std::vector<float>& heights() const { return m_heights; }
+	float min_height() const { return m_min_height; }
+	float max_height() const { return m_max_height; }
+};
+
 class ConvexShape : public Shape
 {
 protected:
@@ -375,4 +478,4 @@ public:
 	virtual ~V150() {}
 };
 
-Shape* CreateGearShape(float radius, float half_thickness, int num_teeth, float tooth_half_width = 0.f);
+Shape* CreateGearShape(float radius, float half_thickness, int num_teeth, float tooth_half_width = 0.f, float quality = 1.f);
@@ -0,0 +1,114 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#pragma once
+
+#include <tuple>
+#include <vector>
+
+// Dense storage of elements with stable ids. The columns (one vector per type)
+// are contiguous and have no holes so they can be scanned linearly, an element
+// is moved when another one is erased so only its id is stable.
+// An id is the index of a slot and the generation of the slot, the slot of an
+// erased element is reused but its id is not handed out again right away.
+// A slot map either hands out the ids or mirrors the ids of another one.
+template<class... Ts>
+class slot_map
+{
+	static constexpr int index_bits = 20;
+	static constexpr int index_mask = (1 << index_bits) - 1;
+	static constexpr int generation_mask = (1 << (31 - index_bits)) - 1;
+
+	std::vector<int> m_slots;		// slot index to the position in the columns, -1 if free
+	std::vector<int> m_generations; // of the slots
+	std::vector<int> m_free;		// free slots, only if the ids are handed out here
+	bool m_allocating = false;
+	std::vector<int> m_ids;			// id of the element at each position
+	std::tuple<std::vector<Ts>...> m_columns;
+
+	static int slot_of(int id) { return id & index_mask; }
+
+public:
+	size_t size() const { return m_ids.size(); }
+	bool empty() const { return m_ids.empty(); }
+	void clear() {
+		m_slots.clear();
+		m_generations.clear();
+		m_free.clear();
+		m_allocating = false;
+		m_ids.clear();
+		std::apply([](auto&... c) { (c.clear(), ...); }, m_columns);
+	}
+
+	// position of the element in the columns, -1 if the id does not exist
+	int find(int id) const {
+		int s = slot_of(id);
+		if (id < 0 || s >= (int)m_slots.size()) return -1;
+		int pos = m_slots[s];
+		return (pos >= 0 && m_ids[pos] == id) ? pos : -1;
+	}
+	bool contains(int id) const { return find(id) >= 0; }
+
+	// adds an element with a new id
+	int insert(Ts... values) {
+		int s;
+		if (m_free.empty()) {
+			s = (int)m_slots.size();
+			m_slots.push_back(-1);
+			m_generations.push_back(0);
+		} else {
+			s = m_free.back();
+			m_free.pop_back();
+		}
+		m_allocating = true;
+		int id = (m_generations[s] << index_bits) | s;
+		insert_at(id, std::move(values)...);
+		return id;
+	}
+
+	// adds an element with the id handed out by another slot map, 
+	// returns false if the slot is taken
+	bool insert_at(int id, Ts... values) {
+		int s = slot_of(id);
+		if (id < 0) return false;
+		if (s >= (int)m_slots.size()) {
+			m_slots.resize(s + 1, -1);
+			m_generations.resize(s + 1, 0);
+		}
+		if (m_slots[s] >= 0) return false;
+		m_slots[s] = (int)m_ids.size();
+		m_ids.push_back(id);
+		std::apply([&](auto&... c) { (c.push_back(std::move(values)), ...); }, m_columns);
+		return true;
+	}
+
+	// the last element takes the place of the erased one
+	bool erase(int id) {
+		int pos = find(id);
+		if (pos < 0) return false;
+		int last = (int)m_ids.size() - 1;
+		if (pos != last) {
+			m_ids[pos] = m_ids[last];
+			m_slots[slot_of(m_ids[pos])] = pos;
+			std::apply([&](auto&... c) { ((c[pos] = std::move(c[last])), ...); }, m_columns);
+		}
+		m_ids.pop_back();
+		std::apply([](auto&... c) { (c.pop_back(), ...); }, m_columns);
+
+		int s = slot_of(id);
+		m_slots[s] = -1;
+		m_generations[s] = (m_generations[s] + 1) & generation_mask;
+		if (m_allocating) m_free.push_back(s);
+		return true;
+	}
+
+	// the columns, indexed by position
+	const std::vector<int>& ids() const { return m_ids; }
+	template<size_t I> auto& column() { return std::get<I>(m_columns); }
+	template<size_t I> const auto& column() const { return std::get<I>(m_columns); }
+	// an element by id, the id must exist
+	template<size_t I> auto& get(int id) { return std::get<I>(m_columns)[find(id)]; }
+};
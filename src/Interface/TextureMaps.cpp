@@ -7,9 +7,19 @@
 #include <string>
 #include <algorithm>
 #include <functional>
+#include <atomic>
+#include <thread>
+#include <fstream>
+#include <sstream>
+#include <cmath>
+#include <iterator>
+#include <boost/interprocess/file_mapping.hpp>
+#include <boost/interprocess/mapped_region.hpp>
 #include "TextureMaps.h"
 #include "../Utils.h"
 
+namespace bip = boost::interprocess;
+
 #define STB_IMAGE_IMPLEMENTATION
 #include <stb_image.h>
 
@@ -19,6 +29,24 @@ size_t Color::hash() const
 	return hash_func((r << 16) | (g << 8) | b);
 }
 
+static void hash_combine(size_t& seed, size_t h)
+{	// mix the bits instead of adding the hashes so that 
+	// different combinations of the same values do not collide
+	seed ^= h + 0x9e3779b97f4a7c15ull + (seed << 6) + (seed >> 2);
+}
+
+size_t TextureMap::TextureKeyHash::operator()(const TextureKey& key) const
+{
+	size_t seed = std::hash<int>()((int)key.type);
+	hash_combine(seed, std::hash<std::string>()(key.path));
+	hash_combine(seed, std::hash<size_t>()(key.width));
+	hash_combine(seed, std::hash<size_t>()(key.height));
+	hash_combine(seed, std::hash<int>()(key.style));
+	hash_combine(seed, key.clr_1.hash());
+	hash_combine(seed, key.clr_2.hash());
+	return seed;
+}
+
 Color::Color(const char* html_color_code)
 {
 	std::string s = html_color_code;
@@ -53,94 +81,304 @@ Color::Color(const char* html_color_code)
 	b = hex & 0xFF;
 }
 
-unsigned int TextureMap::create(size_t width, size_t height, unsigned char* data, size_t nbytes)
-{	// the data should be height * row_bytes which is 4-byte aligned
-	size_t n = row_bytes(width);
+TextureMap::~TextureMap()
+{
+	for (auto& i : m_ImageMap) {
+		release_image(i.second);
+	}
+}
+
+void TextureMap::release_image(Image2D& image)
+{
+	if (image.region != NULL) {
+		delete image.region; // unmap
+	} else {
+		delete[] image.data;
+	}
+	image.region = NULL;
+	image.data = NULL;
+}
+
+unsigned int TextureMap::create(const TextureKey& key, size_t width, size_t height, generator generate)
+{	// the data will be height * row_bytes which is 4-byte aligned
 	Image2D image;
 	image.width = width;
 	image.height = height;
-	image.data = new unsigned char[n * height];
-	if (n == nbytes) {
-		memcpy(image.data, data, n * height);
-	} else {
-		unsigned char* p = image.data;
-		for (int i = 0; i < height; i++) {
-			memcpy(p, data, width * 3);
-			p += n;
-			data += nbytes;
+	auto i = m_ImageMap.insert({ m_next_image_id, image }).first;
+	m_pending.push_back({ m_next_image_id, key, &(*i).second, std::move(generate) });
+	// ids are handed out in the order of the requests
+	// regardless of the order the images are built
+	return m_next_image_id++;
+}
+
+void TextureMap::build()
+{
+	if (m_pending.empty()) return;
+
+	if (!m_cache_dir.empty()) {
+		std::error_code ec;
+		std::filesystem::create_directories(m_cache_dir, ec);
+		if (ec) {
+			debug_log("Texture cache disabled: %s\n", ec.message().c_str());
+			m_cache_dir.clear();
 		}
 	}
-	m_ImageMap.insert({ m_next_image_id, image });
-	return m_next_image_id++;
+
+	// generate or load the pixels in parallel
+	size_t n = m_pending.size();
+	std::atomic<size_t> next(0);
+	auto worker = [this, &next, n]() {
+		for (size_t i = next++; i < n; i = next++) {
+			build_image(m_pending[i]);
+		}
+	};
+	size_t num_threads = std::min((size_t)std::max(std::thread::hardware_concurrency(), 1u), n);
+	std::vector<std::thread> threads;
+	for (size_t i = 1; i < num_threads; i++) {
+		threads.emplace_back(worker);
+	}
+	worker(); // this thread works too
+	for (auto& t : threads) t.join();
+	m_pending.clear();
+}
+
+void TextureMap::build_image(PendingImage& pending)
+{	// runs on a worker thread, each one builds a different image
+	Image2D& image = *pending.image;
+	image.key = content_key(pending.key);
+	std::filesystem::path file;
+	if (!m_cache_dir.empty() && image.key != 0) {
+		file = cached_image_file(m_cache_dir, image.key);
+		if (load_cached_image(file, image)) return;
+	}
+	image.data = new unsigned char[row_bytes(image.width) * image.height];
+	pending.generate(image.data);
+	if (!file.empty()) save_cached_image(file, image);
+}
+
+//~~~
+// The on-disk cache files have a small header followed by the 
+// 4-byte row aligned pixels so they can be mapped into memory as is
+//~~~
+struct CachedImageHeader
+{
+	char magic[4];
+	uint32_t version;
+	uint64_t key;
+	uint32_t width;
+	uint32_t height;
+};
+static const char cached_image_magic[4] = { 'V', 'S', 'T', 'X' };
+static const uint32_t cached_image_version = 1;
+
+static uint64_t fnv1a(uint64_t hash, const void* data, size_t n)
+{	// a hash that is stable across runs and platforms
+	const unsigned char* p = (const unsigned char*)data;
+	for (size_t i = 0; i < n; i++) {
+		hash ^= p[i];
+		hash *= 0x100000001b3ull;
+	}
+	return hash;
+}
+
+uint64_t TextureMap::content_key(const TextureKey& key)
+{	// returns 0 if the key cannot be determined
+	uint64_t hash = 0xcbf29ce484222325ull;
+	uint32_t params[] = { cached_image_version, (uint32_t)key.type, (uint32_t)key.width, (uint32_t)key.height, (uint32_t)key.style };
+	unsigned char colors[] = { key.clr_1.r, key.clr_1.g, key.clr_1.b, key.clr_2.r, key.clr_2.g, key.clr_2.b };
+	hash = fnv1a(hash, params, sizeof(params));
+	hash = fnv1a(hash, colors, sizeof(colors));
+	if (key.type == ImageFile) {
+		// images are keyed by their content so a modified file is decoded again
+		std::ifstream f(key.path, std::ios::binary);
+		if (!f) return 0;
+		char buf[64 * 1024];
+		while (f) {
+			f.read(buf, sizeof(buf));
+			hash = fnv1a(hash, buf, (size_t)f.gcount());
+		}
+	}
+	return hash == 0 ? 1 : hash;
+}
+
+std::filesystem::path TextureMap::cached_image_file(const std::filesystem::path& dir, uint64_t key)
+{
+	char name[32];
+	snprintf(name, sizeof(name), "%016llx.rgb", (unsigned long long)key);
+	return dir / name;
+}
+
+bool TextureMap::load_cached_image(const std::filesystem::path& file, Image2D& image)
+{
+	std::error_code ec;
+	size_t nbytes = row_bytes(image.width) * image.height;
+	if (std::filesystem::file_size(file, ec) != sizeof(CachedImageHeader) + nbytes || ec) {
+		return false;
+	}
+	try {
+		bip::file_mapping mapping(file.string().c_str(), bip::read_only);
+		bip::mapped_region* region = new bip::mapped_region(mapping, bip::read_only);
+		const CachedImageHeader* header = (const CachedImageHeader*)region->get_address();
+		if (memcmp(header->magic, cached_image_magic, sizeof(header->magic)) != 0 ||
+			header->version != cached_image_version || header->key != image.key ||
+			header->width != image.width || header->height != image.height) {
+			delete region;
+			return false;
+		}
+		image.region = region;
+		image.data = (unsigned char*)(header + 1);
+		return true;
+	} catch (bip::interprocess_exception& e) {
+		debug_log("Failed to map cached texture %s: %s\n", file.string().c_str(), e.what());
+	}
+	return false;
+}
+
+void TextureMap::save_cached_image(const std::filesystem::path& file, const Image2D& image)
+{	// write to a temporary file first so other processes never see a partial image
+	std::ostringstream suffix;
+	suffix << ".tmp" << std::this_thread::get_id();
+	std::filesystem::path tmp = file;
+	tmp += suffix.str();
+
+	CachedImageHeader header;
+	memcpy(header.magic, cached_image_magic, sizeof(header.magic));
+	header.version = cached_image_version;
+	header.key = image.key;
+	header.width = (uint32_t)image.width;
+	header.height = (uint32_t)image.height;
+	{
+		std::ofstream f(tmp, std::ios::binary | std::ios::trunc);
+		f.write((const char*)&header, sizeof(header));
+		f.write((const char*)image.data, row_bytes(image.width) * image.height);
+		if (!f) {
+			debug_log("Failed to write cached texture: %s\n", tmp.string().c_str());
+		}
+	}
+	std::error_code ec;
+	std::filesystem::rename(tmp, file, ec);
+	if (ec) std::filesystem::remove(tmp, ec);
 }
 
 unsigned int TextureMap::from_file(const char* texture_path)
 {	// load image, create texture and generate mipmaps
-	std::hash<std::string> str_hash_func;
-	std::hash<size_t> hash_func;
-	size_t h1 = str_hash_func(texture_path);
-	size_t h2 = hash_func((size_t)TextureMap::ImageFile);
-	size_t hash = hash_func(h1 + h2);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
+	TextureKey key(texture_path);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
 
+	// only read the image header now, decoding is done in build()
 	int width, height, nrChannels;
-	stbi_set_flip_vertically_on_load(true); // tell stb_image.h to flip loaded texture's on the y-axis.
-	unsigned char* data = stbi_load(texture_path, &width, &height, &nrChannels, 0);
-	if (data == NULL)
+	if (!stbi_info(texture_path, &width, &height, &nrChannels))
 	{	// return 0 to draw the object in wireframe mode
 		debug_log("Failed to load texture: %s\n", texture_path);
 		return 0;
 	}
-	unsigned int texture = create(width, height, data, width * 3);
-	stbi_image_free(data);
-	m_TextureCache.insert({ hash, texture });
+	std::string path = texture_path;
+	unsigned int texture = create(key, width, height, [path, width, height](unsigned char* map) {
+		// tell stb_image.h to flip loaded texture's on the y-axis.
+		// use the per-thread flag as this runs on a worker thread
+		stbi_set_flip_vertically_on_load_thread(true);
+		int w, h, n;
+		unsigned char* data = stbi_load(path.c_str(), &w, &h, &n, 3); // always RGB
+		size_t row_width = row_bytes(width);
+		if (data == NULL || w != width || h != height) {
+			// the file has changed since it was inspected
+			debug_log("Failed to load texture: %s\n", path.c_str());
+			memset(map, 0, row_width * height);
+		} else {
+			for (int i = 0; i < height; i++) {
+				memcpy(map + i * row_width, data + i * width * 3, (size_t)width * 3);
+			}
+		}
+		stbi_image_free(data);
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
 
+bool TextureMap::load_height_map(const char* path, int& columns, int& rows, std::vector<float>& samples)
+{
+	std::filesystem::path ext = std::filesystem::path(path).extension();
+	if (ext == ".raw" || ext == ".r16") {
+		std::ifstream f(path, std::ios::binary);
+		std::vector<unsigned char> data((std::istreambuf_iterator<char>(f)), std::istreambuf_iterator<char>());
+		size_t n = data.size() / 2;
+		int side = (int)std::lround(std::sqrt((double)n));
+		// at least two samples along each side to make one cell
+		if (side < 2 || (size_t)side * side != n) {
+			debug_log("Failed to load height map: %s\n", path);
+			return false;
+		}
+		columns = rows = side;
+		samples.resize(n);
+		for (size_t i = 0; i < n; i++) {
+			samples[i] = (data[i * 2] | (data[i * 2 + 1] << 8)) / 65535.f;
+		}
+		return true;
+	}
+
+	// the first row is the top of the image
+	stbi_set_flip_vertically_on_load_thread(false);
+	int w, h, n;
+	if (stbi_is_16_bit(path)) {
+		stbi_us* data = stbi_load_16(path, &w, &h, &n, 1);
+		if (data != NULL) {
+			samples.assign(data, data + (size_t)w * h);
+			for (float& s : samples) s /= 65535.f;
+		}
+		stbi_image_free(data);
+	} else {
+		unsigned char* data = stbi_load(path, &w, &h, &n, 1);
+		if (data != NULL) {
+			samples.assign(data, data + (size_t)w * h);
+			for (float& s : samples) s /= 255.f;
+		}
+		stbi_image_free(data);
+	}
+	if (samples.empty() || w < 2 || h < 2) {
+		debug_log("Failed to load height map: %s\n", path);
+		return false;
+	}
+	columns = w;
+	rows = h;
+	return true;
+}
+
 unsigned int TextureMap::solid_color(const Color& clr)
 {
-	std::hash<size_t> hash_func;
-	size_t h1 = clr.hash();
-	size_t h2 = hash_func((size_t)TextureMap::SolidColor);
-	size_t hash = hash_func(h1 + h2);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
-
-	unsigned char color[4] = { clr.r, clr.g, clr.b, 0 }; // has to be 4-byte aligned
-	unsigned int texture = create(1, 1, color, 4);
-	m_TextureCache.insert({ hash, texture });
+	TextureKey key(SolidColor, 1, 1, 0, clr, clr);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
+
+	unsigned int texture = create(key, 1, 1, [clr](unsigned char* map) {
+		unsigned char color[4] = { clr.r, clr.g, clr.b, 0 }; // has to be 4-byte aligned
+		memcpy(map, color, 4);
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
 
 unsigned int TextureMap::checker_board(size_t width, size_t height, const Color& clr_1, const Color& clr_2)
 {
-	std::hash<size_t> hash_func;
-	size_t h1 = clr_1.hash();
-	size_t h2 = clr_1.hash();
-	size_t h3 = hash_func(width);
-	size_t h4 = hash_func(height);
-	size_t h5 = hash_func((size_t)TextureMap::CheckerBoard);
-	size_t hash = hash_func(h1 + h2 + h3 + h4 + h5);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
+	TextureKey key(CheckerBoard, width, height, 0, clr_1, clr_2);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
 	
-	size_t row_width = row_bytes(width);
-	size_t packing = row_width - (width * 3);
-	unsigned char* map = new unsigned char[row_width * height];
-	unsigned char* p = map;
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			const Color& color = ((x + y) % 2) == 0 ? clr_1 : clr_2;
-			*p++ = color.r;
-			*p++ = color.g;
-			*p++ = color.b;
+	unsigned int texture = create(key, width, height, [width, height, clr_1, clr_2](unsigned char* map) {
+		size_t row_width = row_bytes(width);
+		size_t packing = row_width - (width * 3);
+		unsigned char* p = map;
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				const Color& color = ((x + y) % 2) == 0 ? clr_1 : clr_2;
+				*p++ = color.r;
+				*p++ = color.g;
+				*p++ = color.b;
+			}
+			p += packing;
 		}
-		p += packing;
-	}
-	unsigned int texture = create(width, height, map, row_width);
-	delete[] map;
-	m_TextureCache.insert({ hash, texture });
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
 
@@ -148,96 +386,78 @@ unsigned int TextureMap::diagonal_stripes(size_t width, size_t height, int style
 {
 	style = style & 3; // use only the last two bits
 
-	std::hash<size_t> hash_func;
-	size_t h1 = clr_1.hash();
-	size_t h2 = clr_1.hash();
-	size_t h3 = hash_func(width);
-	size_t h4 = hash_func(height);
-	size_t h5 = hash_func(style);
-	size_t h6 = hash_func((size_t)TextureMap::DiagonalStripes);
-	size_t hash = hash_func(h1 + h2 + h3 + h4 + h5 + h6);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
-
-	size_t row_width = row_bytes(width);
-	size_t packing = row_width - (width * 3);
-	unsigned char* map = new unsigned char[row_width * height];
-	unsigned char* p = map;
-	int s = 4; // change color every (1 << 4) pixels
-	Color edge((clr_1.r + clr_2.r) / 2, (clr_1.g + clr_2.g) / 2, (clr_1.b + clr_2.b) / 2);
-	for (int y = 0; y < height; y++) {
-		for (int x = 0; x < width; x++) {
-			int t = (style & 2) >> 1;
-			int b = style & 1;
-			int d = t ? (x >= (width / 2) ? b : (1 - b)) : style;
-			int xx = d == 0 ? x : (int)width - x - 1;
-			int e = (y + xx) % (2 << s);
-			if (e == 0 || e == ((1 << s) - 1)) {
-				// soften edge pixels
-				*p++ = edge.r;
-				*p++ = edge.g;
-				*p++ = edge.b;
-			} else {
-				const Color& color = (((y + xx) >> s) % 2) == 0 ? clr_1 : clr_2;
-				*p++ = color.r;
-				*p++ = color.g;
-				*p++ = color.b;
+	TextureKey key(DiagonalStripes, width, height, style, clr_1, clr_2);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
+
+	unsigned int texture = create(key, width, height, [width, height, style, clr_1, clr_2](unsigned char* map) {
+		size_t row_width = row_bytes(width);
+		size_t packing = row_width - (width * 3);
+		unsigned char* p = map;
+		int s = 4; // change color every (1 << 4) pixels
+		Color edge((clr_1.r + clr_2.r) / 2, (clr_1.g + clr_2.g) / 2, (clr_1.b + clr_2.b) / 2);
+		for (int y = 0; y < height; y++) {
+			for (int x = 0; x < width; x++) {
+				int t = (style & 2) >> 1;
+				int b = style & 1;
+				int d = t ? (x >= (width / 2) ? b : (1 - b)) : style;
+				int xx = d == 0 ? x : (int)width - x - 1;
+				int e = (y + xx) % (2 << s);
+				if (e == 0 || e == ((1 << s) - 1)) {
+					// soften edge pixels
+					*p++ = edge.r;
+					*p++ = edge.g;
+					*p++ = edge.b;
+				} else {
+					const Color& color = (((y + xx) >> s) % 2) == 0 ? clr_1 : clr_2;
+					*p++ = color.r;
+					*p++ = color.g;
+					*p++ = color.b;
+				}
 			}
+			p += packing;
 		}
-		p += packing;
-	}
-	unsigned int texture = create(width, height, map, row_width);
-	delete[] map;
-	m_TextureCache.insert({ hash, texture });
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
 
 unsigned int TextureMap::vertical_stripes(size_t height, const Color& clr_1, const Color& clr_2)
 {
-	std::hash<size_t> hash_func;
-	size_t h1 = clr_1.hash();
-	size_t h2 = clr_1.hash();
-	size_t h3 = hash_func(height);
-	size_t h4 = hash_func((size_t)TextureMap::VerticalStripes);
-	size_t hash = hash_func(h1 + h2 + h3 + h4);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
-
-	unsigned char* map = new unsigned char[4 * (size_t)height]; // row width with packing = 4
-	unsigned char* p = map;
-	for (int i = 0; i < height; i++) {
-		const Color& clr = (i & 1) == 0 ? clr_1 : clr_2;
-		p[0] = clr.r;
-		p[1] = clr.g;
-		p[2] = clr.b;
-		p += 4;
-	}
-	unsigned int texture = create(1, height, map, 4);
-	m_TextureCache.insert({ hash, texture });
+	TextureKey key(VerticalStripes, 1, height, 0, clr_1, clr_2);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
+
+	unsigned int texture = create(key, 1, height, [height, clr_1, clr_2](unsigned char* map) {
+		unsigned char* p = map; // row width with packing = 4
+		for (int i = 0; i < height; i++) {
+			const Color& clr = (i & 1) == 0 ? clr_1 : clr_2;
+			p[0] = clr.r;
+			p[1] = clr.g;
+			p[2] = clr.b;
+			p[3] = 0;
+			p += 4;
+		}
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
 
 unsigned int TextureMap::horizontal_stripes(size_t width, const Color& clr_1, const Color& clr_2)
 {
-	std::hash<size_t> hash_func;
-	size_t h1 = clr_1.hash();
-	size_t h2 = clr_1.hash();
-	size_t h3 = hash_func(width);
-	size_t h4 = hash_func((size_t)TextureMap::HorizontalStripes);
-	size_t hash = hash_func(h1 + h2 + h3 + h4);
-	auto t = m_TextureCache.find(hash);
-	if (t != m_TextureCache.end()) return (*t).second;
-
-	size_t row_width = row_bytes(width);
-	unsigned char* map = new unsigned char[row_width];
-	unsigned char* p = map;
-	for (int i = 0; i < width; i++) {
-		const Color& clr = (i & 1) == 0 ? clr_1 : clr_2;
-		*p++ = clr.r;
-		*p++ = clr.g;
-		*p++ = clr.b;
-	}
-	unsigned int texture = create(width, 1, map, row_width);
-	m_TextureCache.insert({ hash, texture });
+	TextureKey key(HorizontalStripes, width, 1, 0, clr_1, clr_2);
+	unsigned int cached = find(key);
+	if (cached != 0) return cached;
+
+	unsigned int texture = create(key, width, 1, [width, clr_1, clr_2](unsigned char* map) {
+		unsigned char* p = map;
+		for (int i = 0; i < width; i++) {
+			const Color& clr = (i & 1) == 0 ? clr_1 : clr_2;
+			*p++ = clr.r;
+			*p++ = clr.g;
+			*p++ = clr.b;
+		}
+	});
+	m_TextureCache.insert({ key, texture });
 	return texture;
 }
@@ -7,6 +7,12 @@
 #pragma once
 
 #include <map>
+#include <string>
+#include <cstdint>
+#include <filesystem>
+#include <vector>
+#include <functional>
+#include <unordered_map>
 
 struct Color
 {
@@ -16,15 +22,29 @@ struct Color
 
 	Color(const char* html_color_code); // e.g. "Red" or "#FF0000"
 	Color(unsigned char r, unsigned char g, unsigned char b) : r(r), g(g), b(b) {}
+	Color() : r(0), g(0), b(0) {}
+	bool operator==(const Color& other) const = default;
 	size_t hash() const;
 };
 
+namespace boost { namespace interprocess { class mapped_region; } }
+
 //~~~
 // A collection of 2D images that can be used
 // to create OpenGL texture maps
 //~~~
 class TextureMap
 {
+public:
+	struct Image2D
+	{	// no need to deep copy
+		size_t width, height;
+		unsigned char* data;
+		uint64_t key; // content key, the same image always has the same key
+		boost::interprocess::mapped_region* region; // not NULL if data is mapped from the disk cache
+		Image2D() : width(0), height(0), data(NULL), key(0), region(NULL) {}
+	};
+
 protected:
 	enum Type 
 	{
@@ -36,25 +56,74 @@ protected:
 		HorizontalStripes
 	};
 
-	struct Image2D
-	{	// no need to deep copy
+	// fills the (4-byte row aligned) pixels of an image
+	typedef std::function<void(unsigned char* data)> generator;
+	// a texture is identified by its type and all of its parameters
+	// so cache hits are exact
+	struct TextureKey
+	{
+		Type type;
+		std::string path; // image file
 		size_t width, height;
-		unsigned char* data;
-		Image2D() : width(0), height(0), data(NULL) {}
+		int style;
+		Color clr_1, clr_2;
+
+		TextureKey(Type type, size_t width, size_t height, int style, const Color& clr_1, const Color& clr_2) :
+			type(type), width(width), height(height), style(style), clr_1(clr_1), clr_2(clr_2) {}
+		TextureKey(const char* path) : 
+			type(ImageFile), path(path), width(0), height(0), style(0) {}
+		bool operator==(const TextureKey& other) const = default;
+	};
+	struct TextureKeyHash
+	{
+		size_t operator()(const TextureKey& key) const;
 	};
-	std::map<size_t, unsigned int> m_TextureCache; // maps from hash to id
-	std::map<int, const Image2D> m_ImageMap;	   // maps from id to Image2D
+	struct PendingImage
+	{
+		int id;
+		TextureKey key;
+		Image2D* image;
+		generator generate;
+	};
+	std::unordered_map<TextureKey, unsigned int, TextureKeyHash> m_TextureCache; // maps from key to id
+	std::map<int, Image2D> m_ImageMap;			   // maps from id to Image2D
+	std::vector<PendingImage> m_pending;		   // images waiting to be built
 	int m_next_image_id;
-	size_t row_bytes(size_t width) { return ((((width * 3) + 3) >> 2) << 2); }
-	unsigned int create(size_t width, size_t height, unsigned char* data, size_t nbytes);
+	std::filesystem::path m_cache_dir; // on-disk cache of built images, empty if disabled
+
+	static size_t row_bytes(size_t width) { return ((((width * 3) + 3) >> 2) << 2); }
+	// the id is assigned right away while the pixels are generated by build()
+	unsigned int create(const TextureKey& key, size_t width, size_t height, generator generate);
+	void build_image(PendingImage& pending);
+	// persistent cache: a key that is stable across runs
+	static uint64_t content_key(const TextureKey& key);
+	unsigned int find(const TextureKey& key) const {
+		auto t = m_TextureCache.find(key);
+		return t == m_TextureCache.end() ? 0 : (*t).second;
+	}
 
 public:
 	TextureMap() : m_next_image_id (1000) {}
-	virtual ~TextureMap() { for (auto i : m_ImageMap) delete[] i.second.data; }
+	virtual ~TextureMap();
+
+	// call build() first to have all images ready
+	const std::map<int, Image2D>& get_image_map() const { return m_ImageMap; }
+	// decode and generate all pending images on a pool of worker threads
+	void build();
+	// built images are kept in this folder and memory-mapped on later runs
+	void set_cache_dir(const std::filesystem::path& dir) { m_cache_dir = dir; }
 
-	const std::map<int, const Image2D>& get_image_map() const { return m_ImageMap; }
+	// on-disk cache files of images by content key, also used by the player client
+	// the key, width and height of the image have to be set before loading
+	static std::filesystem::path cached_image_file(const std::filesystem::path& dir, uint64_t key);
+	static bool load_cached_image(const std::filesystem::path& file, Image2D& image);
+	static void save_cached_image(const std::filesystem::path& file, const Image2D& image);
+	static void release_image(Image2D& image);
 	
 	unsigned int from_file(const char* texture_path);
+	// the samples of a grayscale image (8 or 16 bits) or of a raw file (.raw or .r16) 
+	// of square 16-bit little-endian samples, scaled to 0 - 1 row by row from the top
+	static bool load_height_map(const char* path, int& columns, int& rows, std::vector<float>& samples);
 	unsigned int solid_color(const Color& clr);
 	unsigned int checker_board(size_t width, size_t height, const Color& clr_1, const Color& clr_2);
 	// diagonal strip styles:
@@ -0,0 +1,128 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#include <algorithm>
+#include <cstdio>
+#include "LoadTest.h"
+#include "Interface/Bot.h"
+
+// asks the server to end the game once the test is stopping
+class LoadBot : public BotPlayer
+{
+protected:
+	const std::atomic<bool>& m_stopping;
+
+public:
+	LoadBot(const std::atomic<bool>& stopping) : m_stopping(stopping) {}
+	virtual bool end_update(float elapsed_time) {
+		return BotPlayer::end_update(elapsed_time) && !m_stopping;
+	}
+};
+
+void LoadTest::run(int count, float duration)
+{
+	m_sessions = std::vector<session>(count);
+	for (auto& s : m_sessions) {
+		s.stats = {};
+		s.connected = s.done = false;
+	}
+	for (int i = 0; i < count; i++) {
+		m_sessions[i].thread = std::thread(&LoadTest::run_session, this, i);
+	}
+	printf("%d sessions joining %s:%s\n", count, m_host.c_str(), m_port.c_str());
+
+	std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+	std::chrono::steady_clock::time_point last_report = start;
+	PlayerClient::stats last = {};
+	for (bool done = false; !done; ) {
+		std::this_thread::sleep_for(std::chrono::milliseconds(250));
+		std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			done = std::all_of(m_sessions.begin(), m_sessions.end(), [](const session& s) { return s.done; });
+		}
+		if (duration > 0.f && !m_stopping && std::chrono::duration<float>(now - start).count() >= duration) {
+			printf("Ending the game...\n");
+			m_stopping = true;
+		}
+		float period = std::chrono::duration<float>(now - last_report).count();
+		if (period >= m_report_interval || done) {
+			report(period, last);
+			last_report = now;
+		}
+	}
+	for (auto& s : m_sessions) s.thread.join();
+	report_sessions();
+}
+
+void LoadTest::run_session(int which)
+{
+	session& s = m_sessions[which];
+	try
+	{
+		LoadBot bot(m_stopping);
+		PlayerClient player(bot);
+		player.join(m_host.c_str(), m_port.c_str());
+		{
+			std::lock_guard<std::mutex> lock(m_lock);
+			s.connected = true;
+			s.joined = s.updated = std::chrono::steady_clock::now();
+		}
+		for (bool cont = true; cont; ) {
+			cont = player.communicate();
+			std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+			if (!cont || now - s.updated >= std::chrono::seconds(1)) {
+				std::lock_guard<std::mutex> lock(m_lock);
+				s.stats = player.get_stats();
+				s.updated = now;
+			}
+		}
+	} catch (std::exception& e) {
+		std::lock_guard<std::mutex> lock(m_lock);
+		s.error = e.what();
+	}
+	std::lock_guard<std::mutex> lock(m_lock);
+	s.done = true;
+}
+
+void LoadTest::report(float period, PlayerClient::stats& last)
+{
+	PlayerClient::stats total = {};
+	int connected = 0;
+	{
+		std::lock_guard<std::mutex> lock(m_lock);
+		for (const session& s : m_sessions) {
+			if (s.connected && !s.done) connected++;
+			total.messages += s.stats.messages;
+			total.bytes_received += s.stats.bytes_received;
+			total.steps += s.stats.steps;
+			total.latency += s.stats.latency;
+			total.latencies += s.stats.latencies;
+			total.max_latency = std::max(total.max_latency, s.stats.max_latency);
+		}
+	}
+	uint64_t latencies = total.latencies - last.latencies;
+	float latency = latencies > 0 ? (total.latency - last.latency) / latencies : 0.f;
+	printf("%d/%d sessions, %.1f msgs/s, received %.1f KB/s, latency %.2f ms (max %.2f ms)\n",
+		   connected, (int)m_sessions.size(), (total.messages - last.messages) / period,
+		   (total.bytes_received - last.bytes_received) / period / 1024.f,
+		   latency * 1000.f, total.max_latency * 1000.f);
+	last = total;
+}
+
+void LoadTest::report_sessions()
+{
+	printf("session, steps, msgs/s, KB/s, latency ms, max latency ms, error\n");
+	for (size_t i = 0; i < m_sessions.size(); i++) {
+		const session& s = m_sessions[i];
+		float time = std::max(std::chrono::duration<float>(s.updated - s.joined).count(), 0.001f);
+		float latency = s.stats.latencies > 0 ? s.stats.latency / s.stats.latencies : 0.f;
+		printf("%d, %llu, %.1f, %.1f, %.2f, %.2f, %s\n", (int)i + 1,
+			   (unsigned long long)s.stats.steps, s.stats.messages / time,
+			   s.stats.bytes_received / time / 1024.f, latency * 1000.f,
+			   s.stats.max_latency * 1000.f, s.error.c_str());
+	}
+}
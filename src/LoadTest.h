@@ -0,0 +1,53 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include "PlayerProtocol.h"
+
+// Opens many player sessions to a game server from one process, each one
+// driven by a bot without a window, and reports what every session receives.
+// The server waits for every player on every step so each session has its
+// own thread.
+class LoadTest
+{
+protected:
+	struct session
+	{
+		std::thread thread;
+		// copied from the session thread about once a second
+		PlayerClient::stats stats;
+		std::chrono::steady_clock::time_point joined, updated;
+		bool connected;
+		bool done;
+		std::string error;
+	};
+
+	std::string m_host, m_port;
+	std::vector<session> m_sessions; // never resized once the threads run
+	std::mutex m_lock;
+	std::atomic<bool> m_stopping;
+	float m_report_interval; // seconds
+
+	void run_session(int which);
+	// totals of all the sessions since the last report
+	void report(float period, PlayerClient::stats& last);
+	void report_sessions();
+
+public:
+	LoadTest(const std::string& host, const std::string& port) :
+		m_host(host), m_port(port), m_stopping(false), m_report_interval(5.f) {}
+
+	// runs until the server ends the game or for duration seconds if it is
+	// positive, the bots then ask the server to end the game
+	void run(int count, float duration = 0.f);
+};
@@ -4,12 +4,31 @@
  * This software is licensed under the MIT License that can be 
  * found in the LICENSE file at the top of the source tree
  */
+#include <algorithm>
+#include <cstdio>
 #include <boost/json.hpp>
-#include <boost/beast/core/detail/base64.hpp>
 #include "PlayerProtocol.h"
+#include "Interface/TextureMaps.h"
+#include "Utils.h"
 
 namespace json = boost::json;
-namespace base64 = boost::beast::detail::base64;
+
+static const char texture_frame_magic[4] = { 'V', 'S', 'T', 'F' };
+static const char template_frame_magic[4] = { 'V', 'S', 'T', 'M' };
+
+// JSON numbers are doubles in a web browser so 
+// 64-bit keys are sent as hexadecimal strings
+static std::string key_to_string(uint64_t key)
+{
+	char s[32];
+	snprintf(s, sizeof(s), "%016llx", (unsigned long long)key);
+	return s;
+}
+
+static uint64_t key_from_string(const json::string& s)
+{
+	return std::stoull(std::string(s.c_str()), 0, 16);
+}
 
 json::array to_json_array(const float* v, int n)
 {
@@ -99,25 +118,60 @@ void PlayerServer::setup_camera()
 	send_all(msg);
 }
 
-void PlayerServer::add_texture(int id, size_t width, size_t height, unsigned char* data)
-{
-	size_t row_bytes = ((((width * 3) + 3) >> 2) << 2);
-	size_t n = row_bytes * height;
-	size_t len = base64::encoded_size(n);
-	char* p = new char[len];
-	len = base64::encode(p, data, n);	
+void PlayerServer::add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key)
+{	// textures are sent all at once in post_connect()
+	m_textures[id] = { width, height, data, key };
+}	
+
+void PlayerServer::post_connect()
+{	// send the list of textures first, each client then 
+	// requests only the textures that are not in its cache
+	json::array textures;
+	for (const auto& t : m_textures) {
+		textures.emplace_back(json::object{
+			{"id", t.first},
+			{"width", t.second.width},
+			{"height", t.second.height},
+			{"key", key_to_string(t.second.key)}
+		});
+	}
 	json::value v = 
 	{ 
-		{"cmd", "add_texture"},
-		{"id", id},
-		{"width", width},
-		{"height", height},
-		{"data", std::string_view(p, len)}
+		{"cmd", "add_textures"},
+		{"textures", textures}
 	};
-	std::string msg = json::serialize(v);
-	send_all(msg);
-	delete [] p;
-}	
+	send_all(json::serialize(v));
+
+	for (auto& session : m_websockets) {
+		json::value r = json::parse(session->read_msg());
+		for (const auto& id : r.at("ids").as_array()) {
+			send_texture(*session, (int)id.get_int64());
+		}
+	}
+}
+
+void PlayerServer::send_texture(websocket_session& session, int id)
+{
+	auto t = m_textures.find(id);
+	if (t == m_textures.end()) {
+		debug_log("requested texture #%d does not exist\n", id);
+		return;
+	}
+	const texture& txtr = (*t).second;
+	texture_frame_header header;
+	memcpy(header.magic, texture_frame_magic, sizeof(header.magic));
+	header.id = id;
+	header.width = (uint32_t)txtr.width;
+	header.height = (uint32_t)txtr.height;
+	header.key = txtr.key;
+
+	size_t row_bytes = ((((txtr.width * 3) + 3) >> 2) << 2);
+	std::string frame;
+	frame.reserve(sizeof(header) + row_bytes * txtr.height);
+	frame.append((const char*)&header, sizeof(header));
+	frame.append((const char*)txtr.data, row_bytes * txtr.height);
+	session.send_binary(frame);
+}
 
 Controller& PlayerServer::get_controller(int player_id)
 {
@@ -159,12 +213,26 @@ void PlayerServer::set_player_transform(int player_id, const glm::mat4& trans)
 	send_all(msg);	
 }
 
-void PlayerServer::add_shape(int id, const char* json)
+void PlayerServer::add_template(int id, const char* desc, size_t size)
+{
+	template_frame_header header;
+	memcpy(header.magic, template_frame_magic, sizeof(header.magic));
+	header.template_id = id;
+
+	std::string frame;
+	frame.reserve(sizeof(header) + size);
+	frame.append((const char*)&header, sizeof(header));
+	frame.append(desc, size);
+	send_all_binary(frame);
+}
+
+void PlayerServer::add_shape(int id, int template_id, const glm::mat4& trans)
 {
 	json::value v = {
 		{"cmd", "add_shape"},
 		{"shape_id", id},
-		{"descriptor", json::parse(json)}
+		{"template_id", template_id},
+		{"trans", to_json_array(trans)}
 	};
 	std::string msg = json::serialize(v);
 	send_all(msg);
@@ -198,6 +266,7 @@ bool PlayerServer::end_update(float elapsed_time)
 		{"elapsed_time", elapsed_time}
 	};
 	send_all(json::serialize(v));
+	update_stats();
 
 	bool ret = true;
 	for (auto& session : m_websockets) {
@@ -208,6 +277,29 @@ bool PlayerServer::end_update(float elapsed_time)
 	return ret;
 }
 
+void PlayerServer::update_stats()
+{
+	if (m_stats_interval <= 0.f) return;
+	std::chrono::steady_clock::time_point now = std::chrono::steady_clock::now();
+	float tick_time = std::chrono::duration<float>(now - m_tick_start).count();
+	m_tick_time += tick_time;
+	m_max_tick_time = std::max(m_max_tick_time, tick_time);
+	m_ticks++;
+	if (m_stats_start == std::chrono::steady_clock::time_point()) m_stats_start = m_tick_start;
+	float period = std::chrono::duration<float>(now - m_stats_start).count();
+	if (period < m_stats_interval) return;
+
+	uint64_t bytes_sent = 0;
+	for (auto& session : m_websockets) bytes_sent += session->bytes_sent();
+	printf("%d players, %.1f ticks/s, tick %.2f ms (max %.2f ms), sent %.1f KB/s\n",
+		   (int)m_websockets.size(), m_ticks / period, m_tick_time / m_ticks * 1000.f,
+		   m_max_tick_time * 1000.f, (bytes_sent - m_stats_bytes_sent) / period / 1024.f);
+	m_stats_start = now;
+	m_ticks = 0;
+	m_tick_time = m_max_tick_time = 0.f;
+	m_stats_bytes_sent = bytes_sent;
+}
+
 void PlayerServer::disconnect()
 {	// tell all players to disconnect
 	json::value v = {{"cmd", "end"}};
@@ -233,11 +325,90 @@ void PlayerClient::join(const char* host, const char* port)
 	m_websockets.push_back(session);
 }
 
+void PlayerClient::add_textures(websocket_session& session, const json::array& textures)
+{	// use the cached textures and request the rest from the server
+	json::array missing;
+	for (const auto& t : textures) {
+		int id = (int)t.at("id").get_int64();
+		TextureMap::Image2D image;
+		image.width = (size_t)t.at("width").get_int64();
+		image.height = (size_t)t.at("height").get_int64();
+		image.key = key_from_string(t.at("key").as_string());
+		if (!m_cache_dir.empty() && image.key != 0 &&
+			TextureMap::load_cached_image(TextureMap::cached_image_file(m_cache_dir, image.key), image)) {
+			m_renderer.add_texture(id, image.width, image.height, image.data, image.key);
+			TextureMap::release_image(image);
+		} else {
+			missing.emplace_back(id);
+		}
+	}
+	json::value v = 
+	{
+		{"cmd", "request_textures"},
+		{"ids", missing}
+	};
+	session.send_msg(json::serialize(v));
+}
+
+void PlayerClient::add_texture(const std::string& frame)
+{
+	texture_frame_header header;
+	if (frame.size() < sizeof(header)) return;
+	memcpy(&header, frame.data(), sizeof(header));
+	size_t row_bytes = ((((header.width * 3) + 3) >> 2) << 2);
+	if (memcmp(header.magic, texture_frame_magic, sizeof(header.magic)) != 0 ||
+		frame.size() != sizeof(header) + row_bytes * header.height) {
+		debug_log("invalid texture frame\n");
+		return;
+	}
+	TextureMap::Image2D image;
+	image.width = header.width;
+	image.height = header.height;
+	image.key = header.key;
+	image.data = (unsigned char*)frame.data() + sizeof(header);
+	m_renderer.add_texture(header.id, image.width, image.height, image.data, image.key);
+	if (!m_cache_dir.empty() && image.key != 0) {
+		std::error_code ec;
+		std::filesystem::create_directories(m_cache_dir, ec);
+		TextureMap::save_cached_image(TextureMap::cached_image_file(m_cache_dir, image.key), image);
+	}
+}
+
+void PlayerClient::add_template(const std::string& frame)
+{
+	template_frame_header header;
+	if (frame.size() < sizeof(header)) return;
+	memcpy(&header, frame.data(), sizeof(header));
+	m_renderer.add_template(header.template_id, frame.data() + sizeof(header), frame.size() - sizeof(header));
+}
+
+void PlayerClient::record_latency()
+{
+	if (m_replied == std::chrono::steady_clock::time_point()) return;
+	float latency = std::chrono::duration<float>(std::chrono::steady_clock::now() - m_replied).count();
+	m_stats.latency += latency;
+	m_stats.max_latency = std::max(m_stats.max_latency, latency);
+	m_stats.latencies++;
+	m_replied = std::chrono::steady_clock::time_point();
+}
+
 bool PlayerClient::communicate() 
 {
 	bool cont = true;
 	auto& session = m_websockets[0];
 	std::string s = session->read_msg();
+	m_stats.messages++;
+	if (session->got_binary()) {
+		// binary messages are textures and shape templates
+		if (s.size() >= 4 && memcmp(s.data(), texture_frame_magic, 4) == 0) {
+			add_texture(s);
+		} else if (s.size() >= 4 && memcmp(s.data(), template_frame_magic, 4) == 0) {
+			add_template(s);
+		} else {
+			debug_log("unknown binary message\n");
+		}
+		return cont;
+	}
 	json::value msg = json::parse(s);
 	const json::string cmd = msg.at("cmd").as_string();
 	if (cmd == "set_player_id") {
@@ -248,19 +419,10 @@ bool PlayerClient::communicate()
 		from_json_array(eye, msg.at("eye").as_array());
 		from_json_array(target, msg.at("target").as_array());
 		m_renderer.setup_camera(follow, eye, target);
-	} else if (cmd == "add_texture") {
-		int id = (int)msg.at("id").get_int64();
-		size_t width = (int)msg.at("width").get_int64();
-		size_t height = (int)msg.at("height").get_int64();
-		json::string data = msg.at("data").as_string();
-		
-		size_t n = data.size();
-		size_t len = base64::decoded_size(n);
-		unsigned char* p = new unsigned char [len];		
-		base64::decode(p, data.c_str(), n);
-		m_renderer.add_texture(id, width, height, p);
-		delete [] p;
+	} else if (cmd == "add_textures") {
+		add_textures(*session, msg.at("textures").as_array());
 	} else if (cmd == "get_controller") {
+		record_latency();
 		const Controller& ctlr = m_renderer.get_controller(0);
 		json::array keyboard, mouse;
 		for (int k : ctlr.m_keyboard) keyboard.emplace_back(k);
@@ -275,7 +437,7 @@ bool PlayerClient::communicate()
 			{"cursor_scroll_pos", to_json_array(ctlr.m_scroll_pos)}
 
 		};
-		session->send_msg(json::serialize(v));
+		reply(*session, json::serialize(v));
 	}
 	else if (cmd == "set_player_transform") {
 		int player_id = (int)msg.at("player_id").get_int64();
@@ -286,8 +448,10 @@ bool PlayerClient::communicate()
 		}
 	} else if (cmd == "add_shape") {
 		int shape_id = (int)msg.at("shape_id").get_int64();
-		json::value desc = msg.at("descriptor");
-		m_renderer.add_shape(shape_id, json::serialize(desc).c_str());
+		int template_id = (int)msg.at("template_id").get_int64();
+		glm::mat4 m;
+		from_json_array(m, msg.at("trans").as_array());
+		m_renderer.add_shape(shape_id, template_id, m);
 	} else if (cmd == "update_shape") {
 		int shape_id = (int)msg.at("shape_id").get_int64();
 		glm::mat4 m;
@@ -297,10 +461,12 @@ bool PlayerClient::communicate()
 		int shape_id = (int)msg.at("shape_id").get_int64();
 		m_renderer.remove_shape(shape_id);
 	} else if (cmd == "end_update") {
+		record_latency();
+		m_stats.steps++;
 		float elapsed_time = (float)msg.at("elapsed_time").get_double();
 		bool ret = m_renderer.end_update(elapsed_time);
 		json::value r = {{"continue", ret}};
-		session->send_msg(json::serialize(r));
+		reply(*session, json::serialize(r));
 	} else if (cmd == "end") {
 		for (auto& session : m_websockets) {
 			session->close();
@@ -6,6 +6,11 @@
  */
 #pragma once
 
+#include <map>
+#include <chrono>
+#include <cstdint>
+#include <filesystem>
+#include <boost/json.hpp>
 #include <boost/beast/core.hpp>
 #include <boost/beast/websocket.hpp>
 #include "Interface/Renderer.h"
@@ -16,12 +21,44 @@ namespace websocket = beast::websocket; // from <boost/beast/websocket.hpp>
 namespace net = boost::asio;            // from <boost/asio.hpp>
 using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
 
+// compress the websocket messages (permessage-deflate) when the peer supports it
+#define PERMESSAGE_DEFLATE 1
+
+// a texture is sent in a binary message: this header followed by 
+// the 4-byte row aligned RGB pixels, all numbers are little-endian
+struct texture_frame_header
+{
+	char magic[4]; // "VSTF"
+	uint32_t id;
+	uint32_t width;
+	uint32_t height;
+	uint64_t key;  // content key of the image
+};
+
+// a shape template is sent in a binary message: this header followed by 
+// the binary shape descriptor (see shape_desc_header)
+struct template_frame_header
+{
+	char magic[4]; // "VSTM"
+	int32_t template_id;
+};
+
 class websocket_session {
 	beast::flat_buffer buffer_;
     websocket::stream<beast::tcp_stream> ws_;
+	// payload bytes, before compression
+	uint64_t bytes_sent_;
+	uint64_t bytes_received_;
 
 public:
-	websocket_session(tcp::socket&& socket) : ws_(std::move(socket)) {}
+	websocket_session(tcp::socket&& socket) : ws_(std::move(socket)), bytes_sent_(0), bytes_received_(0) {
+#if PERMESSAGE_DEFLATE
+		websocket::permessage_deflate pmd;
+		pmd.server_enable = true;
+		pmd.client_enable = true;
+		ws_.set_option(pmd);
+#endif
+	}
 	~websocket_session() {}
 
 	void close() { ws_.close(websocket::close_code::normal); }
@@ -32,8 +69,25 @@ public:
 		if (error) {
 			throw boost::system::system_error(error);
 		}
+		bytes_sent_ += msg.size();
 	}
 	
+	void send_binary(const std::string& msg) {
+		boost::system::error_code error;
+		ws_.binary(true);
+		ws_.write(net::buffer(msg.c_str(), msg.size()), error);
+		ws_.text(true);
+		if (error) {
+			throw boost::system::system_error(error);
+		}
+		bytes_sent_ += msg.size();
+	}
+
+	// true if the last message read is binary
+	bool got_binary() const { return ws_.got_binary(); }
+	uint64_t bytes_sent() const { return bytes_sent_; }
+	uint64_t bytes_received() const { return bytes_received_; }
+
 	std::string read_msg() {
 		boost::system::error_code error;	
 		size_t n = ws_.read(buffer_, error);	
@@ -43,6 +97,7 @@ public:
 		std::string msg;
 		msg.assign((const char*)buffer_.cdata().data(), n);
 		buffer_.consume(n);
+		bytes_received_ += n;
 		return std::move(msg);
 	}
 
@@ -83,6 +138,12 @@ protected:
 			session->send_msg(msg);
 		}
 	}
+
+	void send_all_binary(const std::string& msg) { 
+		for (auto& session : m_websockets) {
+			session->send_binary(msg);
+		}
+	}
 };
 
 class PlayerServer : public PlayerProtocol, public Renderer
@@ -94,9 +155,27 @@ protected:
 	glm::vec3 m_camera_pos, m_camera_target;
 	bool m_camera_follow_player;
 
+	struct texture {
+		size_t width, height;
+		unsigned char* data; // owned by the scene's texture map
+		uint64_t key;
+	};
+	std::map<int, texture> m_textures;
+	void send_texture(websocket_session& session, int id);
+
+	// the tick time is from begin_update() to the end_update() broadcast, 
+	// it leaves out waiting for the players
+	std::chrono::steady_clock::time_point m_tick_start, m_stats_start;
+	float m_stats_interval; // seconds, 0 to disable
+	int m_ticks;
+	float m_tick_time, m_max_tick_time;
+	uint64_t m_stats_bytes_sent;
+	void update_stats();
+
 public:
 	PlayerServer(int port) : m_endpoint(tcp::v4(), port), m_acceptor(m_io_context, m_endpoint),
-							 m_camera_pos(0.f, 0.f, 0.f), m_camera_target(0.f, 0.f, 1.f), m_camera_follow_player(false) {}
+							 m_camera_pos(0.f, 0.f, 0.f), m_camera_target(0.f, 0.f, 1.f), m_camera_follow_player(false),
+							 m_stats_interval(10.f), m_ticks(0), m_tick_time(0.f), m_max_tick_time(0.f), m_stats_bytes_sent(0) {}
 	virtual ~PlayerServer() {}
 
 	void accept_player();
@@ -108,31 +187,64 @@ public:
 		m_camera_target = target;
 	}
 	virtual void pre_connect();
-	virtual void post_connect() {};
-	virtual void begin_update() {};
+	virtual void post_connect();
+	virtual void begin_update() { m_tick_start = std::chrono::steady_clock::now(); }
 	virtual bool end_update(float elapsed_time);
 	virtual void setup_camera();
-	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data);
+	virtual void add_texture(int id, size_t width, size_t height, unsigned char* data, uint64_t key);
 	virtual Controller& get_controller(int player_id);
 	virtual void set_player_transform(int player_id, const glm::mat4& trans);
-	virtual void add_shape(int id, const char* json);
+	virtual void add_template(int id, const char* desc, size_t size);
+	virtual void add_shape(int id, int template_id, const glm::mat4& trans);
 	virtual void update_shape(int id, const glm::mat4& trans);
 	virtual void remove_shape(int id);
 	void disconnect();
+	void set_stats_interval(float seconds) { m_stats_interval = seconds; }
 };
 
 class PlayerClient : public PlayerProtocol
 {
+public:
+	// the latency is from a reply to the next request of the server, 
+	// it includes the round trip and the server waiting for the other players
+	struct stats
+	{
+		uint64_t messages;
+		uint64_t bytes_received;
+		uint64_t steps;
+		float latency;		// sum of all latencies in seconds
+		float max_latency;
+		uint64_t latencies;
+	};
+
 protected:
 	Renderer& m_renderer;
 	tcp::resolver m_resolver;
 	int m_player_id;
+	std::filesystem::path m_cache_dir; // local texture cache, empty if disabled
+	stats m_stats;
+	std::chrono::steady_clock::time_point m_replied;
+
+	void reply(websocket_session& session, const std::string& msg) {
+		session.send_msg(msg);
+		m_replied = std::chrono::steady_clock::now();
+	}
+	void record_latency();
+
+	void add_textures(websocket_session& session, const boost::json::array& textures);
+	void add_texture(const std::string& frame);
+	void add_template(const std::string& frame);
 
 public:
 	PlayerClient(Renderer& renderer) : 
-		m_renderer(renderer), m_player_id(-1), m_resolver(m_io_context) {}
+		m_renderer(renderer), m_player_id(-1), m_resolver(m_io_context), m_stats{} {}
 	virtual ~PlayerClient() {}
 
+	void set_texture_cache_dir(const std::filesystem::path& dir) { m_cache_dir = dir; }
 	void join(const char* host, const char* port);
 	bool communicate();
+	const stats& get_stats() {
+		if (!m_websockets.empty()) m_stats.bytes_received = m_websockets[0]->bytes_received();
+		return m_stats;
+	}
 };
@@ -0,0 +1,97 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#include "ActorTables.h"
+#include "PhysicsWorld.h"
+
+//~~~
+// gun_table
+//~~~
+void gun_table::update(PhysicsWorld& world, float elapsed_time)
+{
+	for (float& since_last_shot : guns.column<0>()) since_last_shot += elapsed_time;
+
+	// a projectile can hit more than one object in a step
+	for (btCollisionObject* body : impacts) {
+		int id = body->getUserIndex();
+		int pos = projectiles.find(id);
+		if (pos < 0) continue;
+		btRigidBody* projectile = projectiles.column<0>()[pos];
+		int gun = guns.find(projectiles.column<1>()[pos]);
+		if (gun >= 0) {
+			if (guns.column<2>()[gun] == projectile) {
+				guns.column<2>()[gun] = NULL;
+			} else {
+				guns.column<1>()[gun] -= 1;
+			}
+		}
+		projectiles.erase(id);
+		world.removeRigidBody(projectile);
+	}
+	impacts.clear();
+}
+
+void gun_table::erase(int gun)
+{	// backwards since the last projectile takes the place of an erased one
+	for (int pos = (int)projectiles.size() - 1; pos >= 0; pos--) {
+		if (projectiles.column<1>()[pos] != gun) continue;
+		projectiles.column<0>()[pos]->setUserPointer(NULL); // the gun is gone
+		projectiles.erase(projectiles.ids()[pos]);
+	}
+	guns.erase(gun);
+}
+
+//~~~
+// raycast_vehicle_table
+//~~~
+// calls apply for the vehicles with inputs to apply or to release
+template<class F>
+static void apply_inputs(raycast_vehicle_table& table, bool one_step_steering, F apply)
+{
+	std::vector<btRaycastVehicle*>& vehicles = table.vehicles.column<0>();
+	std::vector<float>& engine_force = table.vehicles.column<1>();
+	std::vector<float>& brake_force = table.vehicles.column<2>();
+	std::vector<float>& steering = table.vehicles.column<3>();
+	std::vector<uint8_t>& state = table.vehicles.column<4>();
+	for (size_t i = 0; i < vehicles.size(); i++) {
+		if (state[i] == raycast_vehicle_table::parked || vehicles[i] == NULL) continue;
+		apply(*vehicles[i], engine_force[i], brake_force[i], steering[i]);
+		engine_force[i] = 0.f;
+		brake_force[i] = 0.f;
+		if (one_step_steering) steering[i] = 0.f;
+		// parked after the step that released the inputs
+		state[i] = (state[i] == raycast_vehicle_table::driven) ? raycast_vehicle_table::released : raycast_vehicle_table::parked;
+	}
+}
+
+void apply_raycast_car_inputs(raycast_vehicle_table& cars)
+{
+	apply_inputs(cars, false, [](btRaycastVehicle& vehicle, float engine_force, float brake_force, float steering) {
+		for (int i = 0; i < vehicle.getNumWheels(); i++) {
+			// 40% of the force on the front wheels like the hinged car
+			bool front = vehicle.getWheelInfo(i).m_bIsFrontWheel;
+			vehicle.applyEngineForce(engine_force * (front ? 0.2f : 0.3f), i);
+			vehicle.setSteeringValue(front ? steering : 0.f, i);
+			vehicle.setBrake(brake_force, i);
+		}
+	});
+}
+
+void apply_raycast_tank_inputs(raycast_vehicle_table& tanks)
+{
+	apply_inputs(tanks, true, [](btRaycastVehicle& vehicle, float engine_force, float brake_force, float turn) {
+		int n = vehicle.getNumWheels();
+		for (int i = 0; i < n; i++) {
+			const btVector3& connection = vehicle.getWheelInfo(i).m_chassisConnectionPointCS;
+			// the sides push the opposite ways to turn
+			float force = engine_force / n + ((connection.x() > 0.f) ? -1.f : 1.f) * turn * 100.f;
+			vehicle.applyEngineForce(force, i);
+			float z = connection.z();
+			vehicle.setSteeringValue((z > 0.f) ? turn : ((z < 0.f) ? -turn : 0.f), i);
+			vehicle.setBrake(brake_force, i);
+		}
+	});
+}
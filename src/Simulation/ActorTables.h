@@ -0,0 +1,50 @@
+/*
+ * Copyright (c) 2023 Isaac Chou
+ *
+ * This software is licensed under the MIT License that can be
+ * found in the LICENSE file at the top of the source tree
+ */
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <btBulletDynamicsCommon.h>
+#include "../Interface/SlotMap.h"
+
+class PhysicsWorld;
+
+// The state an actor touches on every step is kept by the world in one table
+// per actor type and updated by a batch function of that type, the actors only
+// hold the id of their row and stay the interface to the rest of the code.
+
+// the guns and the projectiles they have in flight
+struct gun_table
+{
+	// time since the last shot, bullets in flight, shell in flight (NULL if none)
+	slot_map<float, int, btRigidBody*> guns;
+	// a projectile and the id of the gun that fired it, the id of the
+	// projectile is the user index of its body
+	slot_map<btRigidBody*, int> projectiles;
+	// projectiles that hit something since the last update
+	std::vector<btCollisionObject*> impacts;
+
+	// advances the shot timers and removes the projectiles that hit something
+	void update(PhysicsWorld& world, float elapsed_time);
+	// the projectiles in flight are left in the world but no longer reported
+	void erase(int gun);
+};
+
+// the raycast vehicles of one type, the inputs only last for one simulation step
+struct raycast_vehicle_table
+{
+	enum { parked = 0, released, driven };
+	// the vehicle (NULL until created), engine force, brake force, steering in radians
+	// and the state, a released vehicle has its inputs cleared in the next step
+	slot_map<btRaycastVehicle*, float, float, float, uint8_t> vehicles;
+};
+
+// the front wheels steer and the engine force is shared by all the wheels
+void apply_raycast_car_inputs(raycast_vehicle_table& cars);
+// the steering turns the front and the back wheels the opposite ways and the sides
+// push the opposite ways, it only lasts for one step like the forces
+void apply_raycast_tank_inputs(raycast_vehicle_table& tanks);
@@ -8,6 +8,7 @@
 #include <glm/gtc/matrix_transform.hpp>
 #include <GLFW/glfw3.h>
 #include <algorithm>
+#include <cmath>
 #include "Actors.h"
 #include "../Interface/Shapes.h"
 #include "../Interface/TextureMaps.h"
@@ -39,9 +40,98 @@ static btVector3 get_angular_velocity_local(btRigidBody& obj)
 	return trans.getBasis().transpose() * obj.getAngularVelocity();
 }
 
-Actor::Actor(PhysicsWorld& world) : m_world(world)
+Actor::Actor(PhysicsWorld& world) : m_world(world), m_team(-1),
+	m_owner(NULL), m_awake_interval(0.f), m_idle_time(0.f), m_hibernating(false)
 {
-	m_world.add_actor(*this);
+	m_id = m_world.add_actor(*this);
+}
+
+void Actor::run_update(float elapsed_time)
+{
+	if (m_hibernating) {
+		// only the root actor is polled, it checks if something touched it
+		// or its attached actors
+		if (!is_touched()) return;
+		wake();
+	}
+	update(elapsed_time);
+
+	// the attached actors follow the one they are attached to
+	m_idle_time += elapsed_time;
+	if (m_owner == NULL && m_idle_time >= m_world.get_hibernate_time() && is_at_rest()) {
+		debug_log("actor hibernating after %f seconds without input\n", m_idle_time);
+		hibernate();
+	}
+}
+
+void Actor::on_input()
+{
+	m_idle_time = 0.f;
+	if (m_hibernating) wake();
+}
+
+bool Actor::is_at_rest()
+{
+	const btScalar max_speed = 0.5f;
+	for (btRigidBody* body : m_bodies) {
+		if (body->getLinearVelocity().length2() > max_speed * max_speed ||
+			body->getAngularVelocity().length2() > max_speed * max_speed) {
+			return false;
+		}
+	}
+	for (Actor* actor : m_attached) {
+		if (!actor->is_at_rest()) return false;
+	}
+	return true;
+}
+
+bool Actor::is_touched()
+{	// Bullet wakes up the sleeping bodies touched by an active one
+	for (btRigidBody* body : m_bodies) {
+		if (body->getActivationState() != ISLAND_SLEEPING) return true;
+	}
+	for (Actor* actor : m_attached) {
+		if (actor->is_touched()) return true;
+	}
+	return false;
+}
+
+void Actor::hibernate()
+{	// sleeping bodies are not simulated nor sent to the players
+	if (m_hibernating) return;
+
+	m_activation.clear();
+	for (btRigidBody* body : m_bodies) {
+		m_activation.push_back(body->getActivationState());
+		body->setLinearVelocity(btVector3(0.f, 0.f, 0.f));
+		body->setAngularVelocity(btVector3(0.f, 0.f, 0.f));
+		body->forceActivationState(ISLAND_SLEEPING);
+	}
+	for (Actor* actor : m_attached) actor->hibernate();
+	m_hibernating = true;
+	m_awake_interval = m_world.get_update_interval(m_id);
+	// only the actor at the root checks for contacts, it checks its attached
+	// actors too and wakes them up with it
+	if (m_owner == NULL) {
+		set_update_interval(1.f);
+	} else {
+		m_world.suspend_updates(m_id);
+	}
+}
+
+void Actor::wake()
+{
+	if (!m_hibernating) return;
+
+	for (size_t i = 0; i < m_bodies.size(); i++) {
+		// the bodies that never sleep are restored as such
+		m_bodies[i]->forceActivationState(m_activation[i] == DISABLE_DEACTIVATION ? DISABLE_DEACTIVATION : ACTIVE_TAG);
+		m_bodies[i]->setDeactivationTime(0.f);
+	}
+	for (Actor* actor : m_attached) actor->wake();
+	m_hibernating = false;
+	m_idle_time = 0.f;
+	m_world.resume_updates(m_id, m_awake_interval);
 }
 
 void Actor::attach(Actor& other)
@@ -56,6 +146,41 @@ void Actor::attach(Actor& other)
 	trans_b.setOrigin(other.get_connecting_point());
 	btFixedConstraint* contact = new btFixedConstraint(*a, *b, trans_a, trans_b);
 	m_world.addConstraint(contact, true);
+	m_attached.push_back(&other);
+	other.m_owner = this;
+}
+
+static glm::mat4 to_mat4(const btTransform& trans)
+{
+	glm::mat4 m;
+	trans.getOpenGLMatrix(&m[0][0]);
+	return m;
+}
+
+// an axle with a gear and a guard disk at each end, the axle is along y
+static Shape* create_drive_gear(TextureMap& textures, float gear_radius, float gear_thickness, int num_teeth, float tooth_half_width, float quality)
+{
+	glm::mat4 trans(1.f);
+	
+	CompoundShape* gear_shape = new CompoundShape();
+	CylinderShape* axle = new CylinderShape(gear_radius * 0.5f, gear_thickness, quality);
+	gear_shape->add_child_shape(axle, trans);
+
+	Shape* guard_disk = new CylinderShape(gear_radius + tooth_half_width * 3.f, tooth_half_width, quality);
+	trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, gear_thickness + tooth_half_width, 0.f));
+	gear_shape->add_child_shape(guard_disk, trans);
+	Shape* gear = CreateGearShape(gear_radius, gear_thickness * 0.1f, num_teeth, tooth_half_width * 0.9f, quality);
+	trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, gear_thickness * 0.5f, 0.f));
+	gear_shape->add_child_shape(gear, trans);
+
+	guard_disk = new CylinderShape(gear_radius + tooth_half_width * 3.f, tooth_half_width, quality);
+	trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, -(gear_thickness + tooth_half_width), 0.f));
+	gear_shape->add_child_shape(guard_disk, trans);
+	gear = CreateGearShape(gear_radius, gear_thickness * 0.1f, num_teeth, tooth_half_width * 0.9f, quality);
+	trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, -gear_thickness * 0.5f, 0.f));
+	gear_shape->add_child_shape(gear, trans);
+	gear_shape->set_texture(textures.solid_color(Color(80, 80, 80)));
+	return gear_shape;
 }
 
 Car::Car(PhysicsWorld& world) : Vehicle(world), m_gun(world)
@@ -69,6 +194,8 @@ Car::Car(PhysicsWorld& world) : Vehicle(world), m_gun(world)
 	m_right_steer_box = NULL;
 	m_left_steer_hinge = NULL;
 	m_right_steer_hinge = NULL;
+	// the inputs go straight to the hinges, there is nothing to update
+	set_update_interval(1.f);
 }
 
 void Car::accelarate(float torque)
@@ -161,11 +288,11 @@ Car::create_steer_box(float box_size, btRigidBody& car_body, const btVector3& pi
 	unsigned texture = 0; // for now
 	btTransform trans = car_body.getCenterOfMassTransform();
 	btVector3 pivot_in_box(0.f, -box_size, 0.f);
-	CylinderShape* cylinder = new CylinderShape (box_size, box_size);
+	CylinderShape* cylinder = new CylinderShape (box_size, box_size, m_world.get_mesh_quality());
 	cylinder->add_texture(m_world.get_texture_map().solid_color(Color(45, 45, 45)), 6);
-	btRigidBody* box = m_world.createRigidBody(*cylinder,
-											   trans(pivot_in_car) - pivot_in_box,
-											   btQuaternion(btVector3(0.f, 0.f, 1.f), 0.f), 1.0);
+	btRigidBody* box = create_body(*cylinder,
+								   trans(pivot_in_car) - pivot_in_box,
+								   btQuaternion(btVector3(0.f, 0.f, 1.f), 0.f), 1.0);
 	btHingeConstraint* hinge = new btHingeConstraint(car_body, *box, pivot_in_car, pivot_in_box,
 													 btVector3(0.f, 1.f, 0.f), btVector3(0.f, 1.f, 0.f), false);
 	hinge->setLimit(glm::radians(0.f), glm::radians(0.f));
@@ -179,14 +306,14 @@ btRigidBody* Car::create_wheel(float radius, float width, float spacing, btRigid
 	btTransform trans = car_body.getCenterOfMassTransform();
 	float pivot_in_wheel = width + spacing;
 	
-	CylinderShape* cylinder = new CylinderShape (radius, width);
+	CylinderShape* cylinder = new CylinderShape (radius, width, m_world.get_mesh_quality());
 	cylinder->add_texture(m_world.get_texture_map().solid_color(Color(20, 20, 20)));	// inside face 
 	cylinder->add_texture(m_world.get_texture_map().solid_color(Color(30, 30, 30)));
 	cylinder->add_texture(m_world.get_texture_map().solid_color(Color(50, 50, 50)));	// outside face
-	btRigidBody* wheel = m_world.createRigidBody(*cylinder,
-												 trans(pivot_in_car) + btVector3(left ? pivot_in_wheel : -pivot_in_wheel, 0.f, 0.f),
-												 btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(left ? 90.f : -90.f)),
-												 10.f);
+	btRigidBody* wheel = create_body(*cylinder,
+									 trans(pivot_in_car) + btVector3(left ? pivot_in_wheel : -pivot_in_wheel, 0.f, 0.f),
+									 btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(left ? 90.f : -90.f)),
+									 10.f);
 	btHingeConstraint* hinge; // untracked hinges between the wheels and body/steer boxes
 	hinge = new btHingeConstraint(car_body, *wheel, pivot_in_car, btVector3(0.f, pivot_in_wheel, 0.f),
 								  btVector3(left ? -1.f : 1.f, 0.f, 0.f), btVector3(0.f, 1.f, 0.f), false);
@@ -219,9 +346,9 @@ void Car::create(const btVector3& pos, float)
 	unsigned int texture = 0;
 	Shape* shape = new V150(0.6f);
 	shape->set_texture(m_world.get_texture_map().solid_color(Color(60, 60, 60)));
-	m_car_body = m_world.createRigidBody(*shape,
-										 btVector3(0.0f, wheel_radius - (car_half_thickness + steer_box_size), 0.0f) + pos,
-										 btQuaternion(btVector3(0.f, 0.f, 1.f), 0.f), car_body_weight);
+	m_car_body = create_body(*shape,
+							 btVector3(0.0f, wheel_radius - (car_half_thickness + steer_box_size), 0.0f) + pos,
+							 btQuaternion(btVector3(0.f, 0.f, 1.f), 0.f), car_body_weight);
 	btVector3 pivot_in_car(car_half_width - steer_box_size, -car_half_thickness, wheel_distance);
 	std::tie(m_left_steer_box, m_left_steer_hinge) = create_steer_box(steer_box_size, *m_car_body, pivot_in_car);
 	pivot_in_car.setX(-pivot_in_car.x()); // the opposite side
@@ -244,16 +371,19 @@ void Car::create(const btVector3& pos, float)
 	m_rear_right_wheel = create_wheel(wheel_radius, wheel_width, wheel_spacing, *m_car_body, pivot_in_car);
 
 	// create the gun turret
+	m_gun.set_team(m_team);
 	m_gun.create(pos + get_connecting_point(), 0.7f);
 	attach(m_gun);
 }
 
-Tank::Tank(PhysicsWorld& world) : Vehicle(world), m_gun(world), m_gear{0}
+Tank::Tank(PhysicsWorld& world, bool animated_tracks) : Vehicle(world), m_gun(world), m_gear{0}, m_gear_hinge{0},
+	m_animated_tracks(animated_tracks), m_tracks{ TrackLinks(world), TrackLinks(world) }, 
+	m_gear_angle{ 0.f, 0.f, 0.f, 0.f }, m_track_radius(0.f)
 {
 	m_tank_body = NULL;
 	m_max_velocity = 3.f;
-	m_max_update = 120; // will be adjusted to frame rate in the update loop
-	m_update = 0;
+	m_hold_time = 6.f;
+	m_hold = 0.f;
 }
 
 void Tank::accelarate(float torque)
@@ -267,12 +397,12 @@ void Tank::accelarate(float torque)
 			i += 1;
 		}
 	}
-	m_update = m_max_update;
+	m_hold = m_hold_time;
 }
 
 void Tank::brake()
 {
-	m_update = 0;
+	m_hold = 0.f;
 }
 
 void Tank::turn(float torque)
@@ -284,7 +414,7 @@ void Tank::turn(float torque)
 			apply_torque_impulse(*gear, f);
 		}
 	}
-	m_update = m_max_update;
+	m_hold = m_hold_time;
 }
 
 void Tank::steer_left()
@@ -299,21 +429,45 @@ void Tank::steer_right()
 
 void Tank::update(float elapsed_time)
 {	// counter the tension in the tracks to stablize the tank
-	float fps = 1.f / elapsed_time;
-	if (m_update > m_max_update) m_update = m_max_update;
+	// the impulses were tuned at 60 updates per second (20 per simulated second)
+	float steps = elapsed_time * 20.f;
 	for (btRigidBody* gear : m_gear) {
 		btVector3 v = get_angular_velocity_local(*gear);
-		float n = -2.5f * ((float)(m_max_update - m_update) / (float)m_max_update);
+		float n = -2.5f * ((m_hold_time - m_hold) / m_hold_time);
 		btVector3 torque = n * v;
 		// prevent over compensating
 		float f = torque.length();
 		if (f > 2.5f) torque *= (2.5f / f);
-		apply_torque_impulse(*gear, torque);
-		debug_log_mute("fps = %f, m_update = %d, n = %f, v = (%f, %f, %f)\n", fps, m_update, n, v.x(), v.y(), v.z());
+		apply_torque_impulse(*gear, torque * steps);
+		debug_log_mute("elapsed time = %f, m_hold = %f, n = %f, v = (%f, %f, %f)\n", elapsed_time, m_hold, n, v.x(), v.y(), v.z());
+	}
+	m_hold = (m_hold > elapsed_time) ? m_hold - elapsed_time : 0.f;
+}
+
+void Tank::update_visuals()
+{
+	if (!m_animated_tracks || m_tank_body == NULL) return;
+
+	// the top of a track moves with the rim of the gears of its side
+	const float pi = glm::radians(180.f);
+	float distance[2] = { 0.f, 0.f };
+	for (int i = 0; i < 4; i++) {
+		float angle = m_gear_hinge[i]->getHingeAngle();
+		float delta = angle - m_gear_angle[i];
+		m_gear_angle[i] = angle;
+		// the hinge angle wraps around at pi
+		if (delta > pi) delta -= 2.f * pi;
+		else if (delta < -pi) delta += 2.f * pi;
+		// the hinge axis points inwards
+		float side = (i < 2) ? 1.f : -1.f;
+		distance[i / 2] += -side * delta * m_track_radius * 0.5f;
+	}
+
+	btTransform trans;
+	m_tank_body->getMotionState()->getWorldTransform(trans);
+	for (int s = 0; s < 2; s++) {
+		m_tracks[s].update(trans, distance[s]);
 	}
-	m_max_update = static_cast<int>(2.f * fps);
-	if (m_max_update < 10) m_max_update = 10;
-	if (m_update > 0) m_update -= 1;
 }
 
 void Tank::process_player_input(Controller& ctlr)
@@ -336,7 +490,7 @@ void Tank::create(const btVector3& pos, float)
 	BoxShape* body_shape = new BoxShape(body_width, body_height, body_length);
 	body_shape->add_texture(m_world.get_texture_map().diagonal_stripes(160, 32, 2, Color("gold"), Color("black")));
 	body_shape->set_texture(m_world.get_texture_map().solid_color("#505050"));
-	m_tank_body = m_world.createRigidBody(*body_shape, pos, btQuaternion(0.f, 0.f, 0.f), 10.f);
+	m_tank_body = create_body(*body_shape, pos, btQuaternion(0.f, 0.f, 0.f), 10.f);
 
 	float gear_pos = 4.f - 0.3348078f;
 	float spacing = 0.5f;
@@ -347,48 +501,48 @@ void Tank::create(const btVector3& pos, float)
 	int i = 0;
 	for (float x : {1.f, -1.f}) {
 		for (float z : {1.f, -1.f}) {
-			glm::mat4 trans(1.f);
-			
-			CompoundShape* gear_shape = new CompoundShape();
-			CylinderShape* axle = new CylinderShape(gear_radius * 0.5f, gear_thickness);
-			gear_shape->add_child_shape(axle, trans);
-
-			Shape* guard_disk = new CylinderShape(gear_radius + tooth_half_width * 3.f, tooth_half_width);
-			trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, gear_thickness + tooth_half_width, 0.f));
-			gear_shape->add_child_shape(guard_disk, trans);
-			Shape* gear = CreateGearShape(gear_radius, gear_thickness * 0.1f, num_teeth, tooth_half_width * 0.9f);
-			trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, gear_thickness * 0.5f, 0.f));
-			gear_shape->add_child_shape(gear, trans);
-
-			guard_disk = new CylinderShape(gear_radius + tooth_half_width * 3.f, tooth_half_width);
-			trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, -(gear_thickness + tooth_half_width), 0.f));
-			gear_shape->add_child_shape(guard_disk, trans);
-			gear = CreateGearShape(gear_radius, gear_thickness * 0.1f, num_teeth, tooth_half_width * 0.9f);
-			trans = glm::translate(glm::mat4(1.f), glm::vec3(0.f, -gear_thickness * 0.5f, 0.f));
-			gear_shape->add_child_shape(gear, trans);
-			gear_shape->set_texture(m_world.get_texture_map().solid_color(Color(80, 80, 80)));
-
+			Shape* gear_shape = create_drive_gear(m_world.get_texture_map(), gear_radius, gear_thickness, num_teeth, tooth_half_width, m_world.get_mesh_quality());
 			btVector3 pivot_in_tank(x * (body_width + spacing), 0.f, z * gear_pos);
-			m_gear[i] = m_world.createRigidBody(*gear_shape, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
-												btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
+			m_gear[i] = create_body(*gear_shape, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
+									btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
 			btHingeConstraint* hinge = new btHingeConstraint(*m_tank_body, *m_gear[i], 
 															 pivot_in_tank, btVector3(0.f, gear_thickness, 0.f),
 															 btVector3(-x, 0.f, 0.f), btVector3(0.f, 1.f, 0.f), false);
 			m_world.addConstraint(hinge, true);
+			m_gear_hinge[i] = hinge;
+			if (m_animated_tracks) m_gear[i]->setFriction(1.5f);
 			i += 1;
 		}
 	}
 
+	float track_width = (((2.f * glm::radians(180.f) * gear_radius) / num_teeth) - 2.f * tooth_half_width) / 2.f;
+	if (m_animated_tracks) {
+		// no road wheels nor track bodies, the gears touch the ground
+		m_track_radius = gear_radius + tooth_half_width;
+		btTransform trans;
+		m_tank_body->getMotionState()->getWorldTransform(trans);
+		int s = 0;
+		for (float side : {1.f, -1.f}) {
+			m_tracks[s++].create(trans, btVector3(side * (body_width + spacing + gear_thickness), 0.f, 0.f), gear_pos,
+								 m_track_radius, gear_thickness, track_width, 2.f * (track_width + tooth_half_width),
+								 m_world.get_texture_map().solid_color("#505050"), 8);
+		}
+		m_gun.set_team(m_team);
+		m_gun.create(pos + get_connecting_point(), 0.9f);
+		attach(m_gun);
+		return;
+	}
+
 	float wheel_radius = .6f;
 	for (float x : {1.f, -1.f}) {
 		for (float z : {1.f, 0.f, -1.f}) {
 			// bottom wheels
-			CylinderShape* bottom_wheel = new CylinderShape(wheel_radius, gear_thickness * 0.4f);
+			CylinderShape* bottom_wheel = new CylinderShape(wheel_radius, gear_thickness * 0.4f, m_world.get_mesh_quality());
 			bottom_wheel->set_texture(m_world.get_texture_map().solid_color(Color(80, 80, 80)));
 			// position the bottom of the wheel below the drive gear for better climbing capability
 			btVector3 pivot_in_tank(x * (body_width + spacing), -(gear_radius + tooth_half_width + 0.5f) + wheel_radius, z * 1.8f);
-			btRigidBody* gear = m_world.createRigidBody(*bottom_wheel, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
-														btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
+			btRigidBody* gear = create_body(*bottom_wheel, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
+											btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
 			btHingeConstraint* hinge = new btHingeConstraint(*m_tank_body, *gear, 
 															 pivot_in_tank, btVector3(0.f, gear_thickness, 0.f),
 															 btVector3(-x, 0.f, 0.f), btVector3(0.f, 1.f, 0.f), false);
@@ -396,11 +550,11 @@ void Tank::create(const btVector3& pos, float)
 
 			if (z != 0.f) {
 				// top wheels
-				CylinderShape* top_wheel = new CylinderShape(wheel_radius, gear_thickness * 0.4f);
+				CylinderShape* top_wheel = new CylinderShape(wheel_radius, gear_thickness * 0.4f, m_world.get_mesh_quality());
 				top_wheel->set_texture(m_world.get_texture_map().solid_color(Color(80, 80, 80)));
 				btVector3 pivot_in_tank(x * (body_width + spacing), gear_radius - wheel_radius, z);
-				gear = m_world.createRigidBody(*top_wheel, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
-											   btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
+				gear = create_body(*top_wheel, pivot_in_tank + pos + btVector3(x * gear_thickness, 0.f, 0.f),
+								   btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(x * 90.f)), 0.1f);
 				hinge = new btHingeConstraint(*m_tank_body, *gear, 
 											  pivot_in_tank, btVector3(0.f, gear_thickness, 0.f),
 											  btVector3(-x, 0.f, 0.f), btVector3(0.f, 1.f, 0.f), false);
@@ -409,7 +563,6 @@ void Tank::create(const btVector3& pos, float)
 		}
 	}
 
-	float track_width = (((2.f * glm::radians(180.f) * gear_radius) / num_teeth) - 2.f * tooth_half_width) / 2.f;
 	// track length break-down:
 	const float pi = glm::radians(180.f);
 	float section[] = { 2.f * gear_pos, pi * gear_radius, 2.f * gear_pos, pi * gear_radius};
@@ -461,7 +614,7 @@ void Tank::create(const btVector3& pos, float)
 			}
 			BoxShape* track_shape = new BoxShape(gear_thickness, 0.1f, track_width);
 			track_shape->set_texture(m_world.get_texture_map().solid_color("#505050"));
-			btRigidBody* track = m_world.createRigidBody(*track_shape, track_pos + pos, track_rotation, 0.1f);
+			btRigidBody* track = create_body(*track_shape, track_pos + pos, track_rotation, 0.1f);
 			track->setFriction(1.5f);
 			if (last_track != NULL) {
 				btHingeConstraint* hinge = new btHingeConstraint(*track, *last_track, 
@@ -484,6 +637,7 @@ void Tank::create(const btVector3& pos, float)
 		debug_log_mute("track width + spacing: %f, # of tracks: %d\n", 2.f * (track_width + tooth_half_width), num_tracks);
 	}
 	// create the gun turret
+	m_gun.set_team(m_team);
 	m_gun.create(pos + get_connecting_point(), 0.9f);
 	attach(m_gun);
 }
@@ -497,9 +651,12 @@ Gun::Gun(PhysicsWorld& world) : Actor(world)
 	m_body_hinge = NULL; // hinge between gun body and base
 	m_base_hinge = NULL; // hinge_between top and bottom bases
 	m_max_bullets = 30;
-	m_time_since_last_shot = 0.f;
 	m_barrel_radius = 0.f;
-	m_shell = NULL; // only one shell at a time
+	m_row = m_world.get_guns().guns.insert(0.f, 0, NULL); // only one shell at a time
+	m_bullet_shape = NULL;
+	m_shell_shape = NULL;
+	// not scheduled, the world updates all the guns at once
+	m_world.suspend_updates(m_id);
 
 	// all textures have to be created at scene creation time
 	m_projectile_texture = m_world.get_texture_map().solid_color(Color(255, 128, 0));
@@ -522,8 +679,8 @@ void Gun::create(const btVector3& pos, float scale)
 	m_base_half_height *= scale;
 	
 	// Part I: a rotating base consists of two identical cylinders joined by a hinge
-	CylinderShape* bottom_base = new CylinderShape(base_radius, m_base_half_height);
-	CylinderShape* top_base = new CylinderShape(base_radius, m_base_half_height);
+	CylinderShape* bottom_base = new CylinderShape(base_radius, m_base_half_height, m_world.get_mesh_quality());
+	CylinderShape* top_base = new CylinderShape(base_radius, m_base_half_height, m_world.get_mesh_quality());
 	BoxShape* body = new BoxShape(body_half_width, body_half_height, body_length);
 	bottom_base->set_texture(m_world.get_texture_map().solid_color("#404040"));
 	top_base->set_texture(m_world.get_texture_map().solid_color("#404040"));
@@ -539,11 +696,11 @@ void Gun::create(const btVector3& pos, float scale)
 	trans.setIdentity();
 
 	trans.setOrigin(btVector3(0.f, 0.f, 0.f));
-	m_bottom_base = m_world.createRigidBody(*bottom_base,
-											trans.getOrigin() + pos, trans.getRotation(), 5.f);
+	m_bottom_base = create_body(*bottom_base,
+								trans.getOrigin() + pos, trans.getRotation(), 5.f);
 	trans.setOrigin(btVector3(0.f, 2.f * m_base_half_height, 0.f));
-	btRigidBody* top_base_body = m_world.createRigidBody(*turret,
-														 trans.getOrigin() + pos, trans.getRotation(), 2.f);
+	btRigidBody* top_base_body = create_body(*turret,
+											 trans.getOrigin() + pos, trans.getRotation(), 2.f);
 	m_base_hinge = new btHingeConstraint(*m_bottom_base, *top_base_body,
 										 btVector3(0.f, m_base_half_height, 0.f), btVector3(0.f, -m_base_half_height, 0.f),
 										 btVector3(0.f, 1.f, 0.f), btVector3(0.f, 1.f, 0.f));
@@ -551,8 +708,8 @@ void Gun::create(const btVector3& pos, float scale)
 
 	// Part II: gun barrel and turret
 	CompoundShape* gun_shape = new CompoundShape();
-	CylinderShape* barrel = new CylinderShape(m_barrel_radius, barrel_length);
-	CylinderShape* joint = new CylinderShape(m_barrel_radius, body_half_width * 0.75f);
+	CylinderShape* barrel = new CylinderShape(m_barrel_radius, barrel_length, m_world.get_mesh_quality());
+	CylinderShape* joint = new CylinderShape(m_barrel_radius, body_half_width * 0.75f, m_world.get_mesh_quality());
 
 	m = glm::rotate(glm::mat4(1.f), glm::radians(90.f), glm::vec3(0.f, 0.f, 1.f));
 	gun_shape->add_child_shape(joint, m);
@@ -560,9 +717,9 @@ void Gun::create(const btVector3& pos, float scale)
 	m = glm::rotate(m, glm::radians(90.f), glm::vec3(1.f, 0.f, 0.f));
 	gun_shape->add_child_shape(barrel, m);
 	gun_shape->set_texture(m_world.get_texture_map().solid_color("#404040"));
-	m_body = m_world.createRigidBody(*gun_shape, btVector3(0.f, 3.f * m_base_half_height + body_half_height, body_length) + pos,
-									btQuaternion(btVector3(0.f, 1.f, 0.f), glm::radians(0.f)),
-									5.f);
+	m_body = create_body(*gun_shape, btVector3(0.f, 3.f * m_base_half_height + body_half_height, body_length) + pos,
+						btQuaternion(btVector3(0.f, 1.f, 0.f), glm::radians(0.f)),
+						5.f);
 	m_body_hinge = new btHingeConstraint(*top_base_body, *m_body,
 										 btVector3(0.f, m_base_half_height + body_half_height, body_length), 
 										 btVector3(0.f, 0.f, 0.f),
@@ -572,6 +729,13 @@ void Gun::create(const btVector3& pos, float scale)
 	// initial direction
 	m_base_hinge->setLimit(glm::radians(0.f), glm::radians(0.f));
 	m_body_hinge->setLimit(glm::radians(5.f), glm::radians(5.f));
+
+	m_bullet_shape = new SphereShape(0.75f * m_barrel_radius, m_world.get_mesh_quality());
+	m_bullet_shape->add_texture(m_projectile_texture);
+	m_bullet_shape->template_key();
+	m_shell_shape = new CapsuleShape(m_barrel_radius, m_barrel_radius, m_world.get_mesh_quality());
+	m_shell_shape->add_texture(m_projectile_texture);
+	m_shell_shape->template_key();
 }
 
 void Gun::aim(float yaw_delta, float pitch_delta)
@@ -598,31 +762,6 @@ void Gun::aim(float yaw_delta, float pitch_delta)
 	}
 }
 
-void Gun::update(float elapsed_time)
-{	// house keeping: delete spent bullets and shell
-	m_time_since_last_shot += elapsed_time;
-
-	if (!is_ready()) return;
-	if (m_bullets.empty() && m_shell == NULL) return;
-
-	Timer timer; // timing starts now
-	for (btRigidBody*& bullet : m_bullets) {
-		if (m_world.has_contact(bullet)) {
-			m_world.removeRigidBody(bullet);
-			bullet = NULL;
-		}
-	}
-	m_bullets.erase(std::remove(m_bullets.begin(), m_bullets.end(), (btRigidBody*)NULL), m_bullets.end());
-
-	if (m_shell != NULL) {
-		if (m_world.has_contact(m_shell)) {
-			m_world.removeRigidBody(m_shell);
-			m_shell = NULL;
-		}
-	}
-	debug_log_mute("elapsed time in Gun::update(): %f sesonds\n", timer.get_elapsed_time());
-}
-
 void Gun::fire(int ammo_type)
 {
 	if (ammo_type == Bullet) fire_bullet();
@@ -631,49 +770,54 @@ void Gun::fire(int ammo_type)
 
 void Gun::fire_shell()
 {
-	if (m_shell != NULL) return;
+	gun_table& table = m_world.get_guns();
+	btRigidBody*& shell = table.guns.get<2>(m_row);
+	if (shell != NULL) return;
 
 	btScalar caliber = m_barrel_radius;
 	btTransform trans = m_body->getCenterOfMassTransform();
 	btQuaternion rotation = trans.getRotation();
-	CapsuleShape* projectile = new CapsuleShape(caliber, caliber);
-	projectile->add_texture(m_projectile_texture);
-	m_shell = m_world.createRigidBody(*projectile, trans(m_mozzle + btVector3(0.f, 0.f, 2.f * caliber)), // non-overlaping with the barrel
-									  rotation * btQuaternion(btVector3(1.f, 0.f, 0.f), glm::radians(90.f)), 2.f);
+	CapsuleShape* projectile = new CapsuleShape(*m_shell_shape);
+	shell = m_world.createRigidBody(*projectile, trans(m_mozzle + btVector3(0.f, 0.f, 2.f * caliber)), // non-overlaping with the barrel
+									  rotation * btQuaternion(btVector3(1.f, 0.f, 0.f), glm::radians(90.f)), 2.f,
+									  PhysicsWorld::ProjectileGroup, projectile_mask());
 	// enable CCD (Continuous Collision Detection) if distance 
 	// is larger than one bullet caliber in one simulation step
-	m_shell->setCcdMotionThreshold(caliber);
+	shell->setCcdMotionThreshold(caliber);
+	m_world.watch_impacts(shell, *this);
+	shell->setUserIndex(table.projectiles.insert(shell, m_row));
 	btVector3 propulsion = btVector3(0.f, 0.f, 300.f).rotate(rotation.getAxis(), rotation.getAngle());
-	m_shell->applyImpulse(propulsion, btVector3(0.f, 0.f, 0.f));
+	shell->applyImpulse(propulsion, btVector3(0.f, 0.f, 0.f));
 	m_body->applyImpulse(propulsion * -0.05f, btVector3(0.f, 0.f, 0.f));
 }
 
 void Gun::fire_bullet()
 {
-	if (m_bullets.size() >= m_max_bullets || m_time_since_last_shot < 0.1f) {
+	gun_table& table = m_world.get_guns();
+	int pos = table.guns.find(m_row);
+	float& time_since_last_shot = table.guns.column<0>()[pos];
+	int& bullets = table.guns.column<1>()[pos];
+	if (bullets >= m_max_bullets || time_since_last_shot < 0.3f) {
 		return;
 	}
 	btScalar caliber = 0.75f * m_barrel_radius;
 	btTransform trans = m_body->getCenterOfMassTransform();
 	btQuaternion rotation = trans.getRotation();
-	SphereShape* projectile = new SphereShape(caliber);
-	projectile->add_texture(m_projectile_texture);
+	SphereShape* projectile = new SphereShape(*m_bullet_shape);
 	btRigidBody* bullet = m_world.createRigidBody(*projectile, trans(m_mozzle + btVector3(0.f, 0.f, caliber)), // non-overlaping with the barrel
-												  rotation, .5f);
-	for (auto b : m_bullets) {
-		// reduce the objects for contact check
-		bullet->setIgnoreCollisionCheck(b, true);
-	}
+												  rotation, .5f, PhysicsWorld::ProjectileGroup, projectile_mask());
 	// enable CCD (Continuous Collision Detection) if distance 
 	// is larger than one bullet caliber in one simulation step
 	bullet->setCcdMotionThreshold(caliber);
+	m_world.watch_impacts(bullet, *this);
+	bullet->setUserIndex(table.projectiles.insert(bullet, m_row));
 	btVector3 propulsion = btVector3(0.f, 0.f, 80.f).rotate(rotation.getAxis(), rotation.getAngle());
 	bullet->applyImpulse(propulsion, btVector3(0.f, 0.f, 0.f));
 	m_body->applyImpulse(propulsion * -0.05f, btVector3(0.f, 0.f, 0.f));
-	m_bullets.push_back(bullet);
+	bullets += 1;
 	debug_log_mute("# of bullets: %d, time between shots: %f seconds\n",
-				   m_bullets.size(), m_time_since_last_shot);
-	m_time_since_last_shot = 0.f;
+				   bullets, time_since_last_shot);
+	time_since_last_shot = 0.f;
 }
 
 void Gun::process_player_input(Controller& ctlr)
@@ -687,3 +831,327 @@ void Gun::process_player_input(Controller& ctlr)
 	if (ctlr.is_mouse_button_pressed(GLFW_MOUSE_BUTTON_LEFT)) fire(Gun::Bullet);
 	if (ctlr.is_key_pressed(GLFW_KEY_ENTER)) fire(Gun::Shell);
 }
+
+//~~~
+// TrackLinks
+//~~~
+btTransform TrackLinks::link_transform(float s)
+{
+	const float pi = glm::radians(180.f);
+	float g = m_gear_pos, r = m_radius;
+	btVector3 pos;
+	float angle;
+	if (s < 2.f * g) {
+		// top section
+		angle = 0.f;
+		pos = btVector3(0.f, r, s - g);
+	} else if (s < 2.f * g + pi * r) {
+		// front gear
+		angle = (s - 2.f * g) / r;
+		pos = btVector3(0.f, r * glm::cos(angle), g + r * glm::sin(angle));
+	} else if (s < 4.f * g + pi * r) {
+		// bottom section
+		angle = pi;
+		pos = btVector3(0.f, -r, g - (s - 2.f * g - pi * r));
+	} else {
+		// back gear
+		angle = pi + (s - 4.f * g - pi * r) / r;
+		pos = btVector3(0.f, r * glm::cos(angle), -g + r * glm::sin(angle));
+	}
+	return btTransform(btQuaternion(btVector3(1.f, 0.f, 0.f), angle), m_center + pos);
+}
+
+void TrackLinks::create(const btTransform& vehicle, const btVector3& center, float gear_pos, float radius, 
+	float link_half_width, float link_half_length, float pitch, int texture, int phases)
+{
+	m_center = center;
+	m_gear_pos = gear_pos;
+	m_radius = radius;
+	m_length = 4.f * gear_pos + 2.f * glm::radians(180.f) * radius;
+	// the links are spread evenly so the track closes
+	int n = (int)(m_length / pitch);
+	m_pitch = m_length / n;
+	if (phases > 0) {
+		// the links share one shape, each phase moves them by a fraction of the pitch
+		BoxShape* link = new BoxShape(link_half_width, 0.1f, link_half_length);
+		link->set_texture(texture);
+		m_phases.resize(phases);
+		for (int p = 0; p < phases; p++) {
+			for (int i = 0; i < n; i++) {
+				m_phases[p].add_child_shape(link, to_mat4(link_transform((i + (float)p / phases) * m_pitch)));
+			}
+		}
+		// the copies added to the world keep the template key of their phase
+		for (CompoundShape& phase : m_phases) phase.template_key();
+		m_phase = 0;
+		m_track = m_world.add_visual_shape(*new CompoundShape(m_phases[0]), to_mat4(vehicle));
+		return;
+	}
+	for (int i = 0; i < n; i++) {
+		BoxShape* link = new BoxShape(link_half_width, 0.1f, link_half_length);
+		link->set_texture(texture);
+		m_links.push_back(m_world.add_visual_shape(*link, to_mat4(vehicle * link_transform(i * m_pitch))));
+	}
+}
+
+void TrackLinks::update(const btTransform& vehicle, float distance)
+{
+	if (m_links.empty() && m_phases.empty()) return;
+
+	m_travel = std::fmod(m_travel + distance, m_length);
+	if (m_travel < 0.f) m_travel += m_length;
+	if (!m_phases.empty()) {
+		int phases = (int)m_phases.size();
+		int phase = (int)(std::fmod(m_travel, m_pitch) / m_pitch * phases) % phases;
+		if (phase == m_phase) {
+			m_world.move_visual_shape(m_track, to_mat4(vehicle));
+			return;
+		}
+		// the templates of the phases are sent once, then only the shape is replaced
+		m_world.remove_visual_shape(m_track);
+		m_track = m_world.add_visual_shape(*new CompoundShape(m_phases[phase]), to_mat4(vehicle));
+		m_phase = phase;
+		return;
+	}
+	for (size_t i = 0; i < m_links.size(); i++) {
+		float s = std::fmod(i * m_pitch + m_travel, m_length);
+		m_world.move_visual_shape(m_links[i], to_mat4(vehicle * link_transform(s)));
+	}
+}
+
+//~~~
+// RaycastVehicle
+//~~~
+RaycastVehicle::RaycastVehicle(PhysicsWorld& world, raycast_vehicle_table& inputs) : Vehicle(world), m_gun(world), 
+	m_chassis(NULL), m_vehicle(NULL), m_connecting_point(0.f, 0.f, 0.f), m_inputs(inputs)
+{
+	m_row = m_inputs.vehicles.insert(NULL, 0.f, 0.f, 0.f, raycast_vehicle_table::parked);
+	// low priority, it only counts the idle time
+	set_update_interval(0.25f);
+
+	m_tuning.m_suspensionStiffness = 20.f;
+	m_tuning.m_suspensionCompression = 4.4f;
+	m_tuning.m_suspensionDamping = 2.3f;
+	m_tuning.m_frictionSlip = 10.f;
+}
+
+void RaycastVehicle::create_chassis(const Shape& shape, const btVector3& pos, float mass)
+{
+	m_chassis = create_body(shape, pos, btQuaternion(0.f, 0.f, 0.f), mass);
+	m_vehicle = m_world.createRaycastVehicle(m_chassis, m_tuning);
+	m_inputs.vehicles.get<0>(m_row) = m_vehicle;
+}
+
+void RaycastVehicle::hibernate()
+{	// the wheel rays would keep pushing the sleeping chassis
+	if (m_hibernating || !is_ready()) return;
+	m_world.removeRaycastVehicle(m_vehicle);
+	Vehicle::hibernate();
+}
+
+void RaycastVehicle::wake()
+{
+	if (!m_hibernating) return;
+	m_world.addRaycastVehicle(m_vehicle);
+	Vehicle::wake();
+}
+
+void RaycastVehicle::add_wheel(const btVector3& connection, float suspension_length, float radius, bool front, Shape* shape)
+{
+	btWheelInfo& wheel = m_vehicle->addWheel(connection, btVector3(0.f, -1.f, 0.f), btVector3(-1.f, 0.f, 0.f),
+											 suspension_length, radius, m_tuning, front);
+	// less likely to roll over in sharp turns
+	wheel.m_rollInfluence = 0.1f;
+
+	int id = -1;
+	if (shape != NULL) {
+		int i = m_vehicle->getNumWheels() - 1;
+		m_vehicle->updateWheelTransform(i, false);
+		id = m_world.add_visual_shape(*shape, to_mat4(get_wheel_transform(i)));
+	}
+	m_wheel_shapes.push_back(id);
+}
+
+btTransform RaycastVehicle::get_chassis_transform()
+{	// the same interpolated transform the chassis is drawn with
+	btTransform trans;
+	m_chassis->getMotionState()->getWorldTransform(trans);
+	return trans;
+}
+
+btTransform RaycastVehicle::get_wheel_transform(int i)
+{	// the axis of a cylinder is y, turn it to the axle
+	const btWheelInfo& wheel = m_vehicle->getWheelInfo(i);
+	bool left = wheel.m_chassisConnectionPointCS.x() > 0.f;
+	return wheel.m_worldTransform * btTransform(btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(left ? 90.f : -90.f)));
+}
+
+void RaycastVehicle::update_visuals()
+{
+	if (!is_ready()) return;
+
+	for (int i = 0; i < (int)m_wheel_shapes.size(); i++) {
+		if (m_wheel_shapes[i] < 0) continue;
+		m_vehicle->updateWheelTransform(i, true);
+		m_world.move_visual_shape(m_wheel_shapes[i], to_mat4(get_wheel_transform(i)));
+	}
+}
+
+void RaycastVehicle::process_player_input(Controller& ctlr)
+{
+	if (ctlr.is_key_pressed(GLFW_KEY_LEFT)) steer_left();
+	else if (ctlr.is_key_pressed(GLFW_KEY_RIGHT)) steer_right();
+	else if (ctlr.is_key_pressed(GLFW_KEY_END)) steer_center();
+	
+	if (ctlr.is_key_pressed(GLFW_KEY_UP)) accelarate(5.f);
+	else if (ctlr.is_key_pressed(GLFW_KEY_DOWN)) accelarate(-5.f);
+	else if (ctlr.is_key_pressed(GLFW_KEY_SPACE)) brake();
+	
+	m_gun.process_player_input(ctlr);
+}
+
+//~~~
+// RaycastCar
+//~~~
+void RaycastCar::create(const btVector3& pos, float)
+{	// same dimensions as the hinged car
+	float car_mass = 30.f; // body and wheels
+	float car_half_width = 3.f;
+	float car_half_thickness = 2.f;
+	float wheel_distance = 2.55f;
+	float steer_box_size = 0.21f;
+	float wheel_radius = 1.4f;
+	float wheel_width = .5f; // half width
+	float wheel_spacing = .07f;
+	float suspension_length = 0.4f;
+
+	Shape* shape = new V150(0.6f);
+	shape->set_texture(m_world.get_texture_map().solid_color(Color(60, 60, 60)));
+	create_chassis(*shape, btVector3(0.0f, wheel_radius - (car_half_thickness + steer_box_size), 0.0f) + pos, car_mass);
+
+	float x = car_half_width + wheel_width + wheel_spacing;
+	float y = -car_half_thickness + steer_box_size + suspension_length;
+	for (float z : {wheel_distance, -wheel_distance}) {
+		for (float side : {1.f, -1.f}) {
+			CylinderShape* cylinder = new CylinderShape(wheel_radius, wheel_width, m_world.get_mesh_quality());
+			cylinder->add_texture(m_world.get_texture_map().solid_color(Color(20, 20, 20)));	// inside face 
+			cylinder->add_texture(m_world.get_texture_map().solid_color(Color(30, 30, 30)));
+			cylinder->add_texture(m_world.get_texture_map().solid_color(Color(50, 50, 50)));	// outside face
+			add_wheel(btVector3(side * x, y, z), suspension_length, wheel_radius, z > 0.f, cylinder);
+		}
+	}
+
+	// create the gun turret
+	m_connecting_point = btVector3(0.f, 1.2f, 0.f);
+	m_gun.set_team(m_team);
+	m_gun.create(pos + get_connecting_point(), 0.7f);
+	attach(m_gun);
+}
+
+void RaycastCar::turn(float degrees)
+{
+	float max_steering = glm::radians(30.f);
+	float& angle = steering();
+	angle += glm::radians(degrees);
+	if (angle < -max_steering) angle = -max_steering;
+	else if (angle > max_steering) angle = max_steering;
+	drive();
+}
+
+//~~~
+// RaycastTank
+//~~~
+RaycastTank::RaycastTank(PhysicsWorld& world) : RaycastVehicle(world, world.get_raycast_tanks()), 
+	m_tracks{ TrackLinks(world), TrackLinks(world) }, m_gear_shapes{ -1, -1, -1, -1 },
+	m_gear_radius(0.f), m_wheel_radius(0.f), m_wheel_rotation{ 0.f, 0.f }, m_gear_angle{ 0.f, 0.f }
+{
+}
+
+void RaycastTank::create(const btVector3& pos, float)
+{	// same dimensions as the hinged tank
+	float tank_mass = 15.f; // body, gears, wheels and tracks
+	float body_width = 3.f;	  // half width
+	float body_height = .75f; // half height
+	float body_length = 5.f;  // half length
+	BoxShape* body_shape = new BoxShape(body_width, body_height, body_length);
+	body_shape->add_texture(m_world.get_texture_map().diagonal_stripes(160, 32, 2, Color("gold"), Color("black")));
+	body_shape->set_texture(m_world.get_texture_map().solid_color("#505050"));
+	create_chassis(*body_shape, pos, tank_mass);
+
+	float gear_pos = 4.f - 0.3348078f;
+	float spacing = 0.5f;
+	float gear_thickness = 1.0f;
+	int num_teeth = 6;
+	float tooth_half_width = 0.08f;
+	float link_half_thickness = 0.1f;
+	m_gear_radius = 1.f;
+	// the wheels touch the ground where the bottom of the tracks would
+	m_wheel_radius = m_gear_radius + tooth_half_width + link_half_thickness;
+	float suspension_length = 0.3f;
+
+	btTransform trans = get_chassis_transform();
+	float x = body_width + spacing + gear_thickness;
+	int i = 0;
+	for (float side : {1.f, -1.f}) {
+		for (float z : {1.f, -1.f}) {
+			Shape* gear_shape = create_drive_gear(m_world.get_texture_map(), m_gear_radius, gear_thickness, num_teeth, tooth_half_width, m_world.get_mesh_quality());
+			m_gear_origin[i] = btVector3(side * x, 0.f, z * gear_pos);
+			m_gear_shapes[i] = m_world.add_visual_shape(*gear_shape, to_mat4(trans * get_gear_transform(i)));
+			i += 1;
+		}
+		// road wheels under the gears and in the middle, hidden by the tracks
+		for (float z : {1.f, 0.f, -1.f}) {
+			add_wheel(btVector3(side * x, suspension_length, z * gear_pos), suspension_length, m_wheel_radius, z > 0.f, NULL);
+		}
+	}
+
+	float track_width = (((2.f * glm::radians(180.f) * m_gear_radius) / num_teeth) - 2.f * tooth_half_width) / 2.f;
+	int texture = m_world.get_texture_map().solid_color("#505050");
+	for (int s = 0; s < 2; s++) {
+		float side = (s == 0) ? 1.f : -1.f;
+		m_tracks[s].create(trans, btVector3(side * x, 0.f, 0.f), gear_pos, m_gear_radius + tooth_half_width,
+						   gear_thickness, track_width, 2.f * (track_width + tooth_half_width), texture, 8);
+	}
+
+	// create the gun turret
+	m_connecting_point = btVector3(0.f, 0.75f, -1.f);
+	m_gun.set_team(m_team);
+	m_gun.create(pos + get_connecting_point(), 0.9f);
+	attach(m_gun);
+}
+
+btTransform RaycastTank::get_gear_transform(int i)
+{	// spun about the axle then turned so the axle is along x
+	int s = (m_gear_origin[i].x() > 0.f) ? 0 : 1;
+	float side = (s == 0) ? 1.f : -1.f;
+	return btTransform(btQuaternion(btVector3(1.f, 0.f, 0.f), m_gear_angle[s]), m_gear_origin[i]) *
+		   btTransform(btQuaternion(btVector3(0.f, 0.f, 1.f), glm::radians(side * 90.f)));
+}
+
+void RaycastTank::update_visuals()
+{
+	if (!is_ready()) return;
+
+	// each track is moved by how far the wheels of its side rolled
+	float rotation[2] = { 0.f, 0.f };
+	int count[2] = { 0, 0 };
+	for (int i = 0; i < m_vehicle->getNumWheels(); i++) {
+		const btWheelInfo& wheel = m_vehicle->getWheelInfo(i);
+		int s = (wheel.m_chassisConnectionPointCS.x() > 0.f) ? 0 : 1;
+		rotation[s] += wheel.m_rotation;
+		count[s] += 1;
+	}
+
+	btTransform trans = get_chassis_transform();
+	for (int s = 0; s < 2; s++) {
+		if (count[s] == 0) continue;
+		rotation[s] /= count[s];
+		float distance = (rotation[s] - m_wheel_rotation[s]) * m_wheel_radius;
+		m_wheel_rotation[s] = rotation[s];
+		m_tracks[s].update(trans, distance);
+		m_gear_angle[s] += distance / m_gear_radius;
+	}
+	for (int i = 0; i < 4; i++) {
+		m_world.move_visual_shape(m_gear_shapes[i], to_mat4(trans * get_gear_transform(i)));
+	}
+}
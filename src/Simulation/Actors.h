@@ -14,6 +14,31 @@ class Actor
 {
 protected:
 	PhysicsWorld& m_world;
+	int m_team; // -1 if not in a team
+	int m_id;	// in the schedule of the world
+
+	// hibernation, an actor without input and at rest is taken out of the 
+	// simulation until an input or a contact wakes it up
+	std::vector<btRigidBody*> m_bodies; // created by create_body()
+	std::vector<Actor*> m_attached;		// hibernate along with this actor
+	Actor* m_owner;						// this actor is attached to it
+	std::vector<int> m_activation;		// of the bodies before hibernating
+	float m_awake_interval;				// update interval before hibernating
+	float m_idle_time;					// since the last input
+	bool m_hibernating;
+
+	bool is_at_rest();
+	bool is_touched();
+	virtual void hibernate();
+	virtual void wake();
+
+	// the collision group of the bodies of this actor
+	int collision_group() { return m_team < 0 ? PhysicsWorld::VehicleGroup : PhysicsWorld::TeamGroup << m_team; }
+	btRigidBody* create_body(const Shape& shape, btVector3 origin, btQuaternion rotation, btScalar mass) {
+		btRigidBody* body = m_world.createRigidBody(shape, origin, rotation, mass, collision_group());
+		m_bodies.push_back(body);
+		return body;
+	}
 
 	virtual btRigidBody* get_connecting_body() = 0;
 	virtual btVector3 get_connecting_point() = 0;
@@ -22,16 +47,34 @@ protected:
 
 public:
 	Actor(PhysicsWorld& world);
-	virtual ~Actor() {}
+	virtual ~Actor() { m_world.remove_actor(m_id); }
 
 	// pos in other body's local frame
 	void attach(Actor& other);
+	// projectiles do not hit the vehicles of their own team, set before create()
+	void set_team(int team) { m_team = (team >= 0 && team < PhysicsWorld::max_teams) ? team : -1; }
+
+	// scheduling in simulated seconds, a low priority actor (idle, parked...) 
+	// is updated every interval instead of every step, setting the interval 
+	// to 0 makes it due on the next step
+	void set_update_interval(float interval) { m_world.set_update_interval(m_id, interval); }
+	float time_since_update() { return m_world.get_time_since_update(m_id); }
+	// called by the world with the time since the last update
+	void run_update(float elapsed_time);
+	// resets the idle time, a hibernating actor is woken up right away
+	void on_input();
+	bool is_hibernating() const { return m_hibernating; }
 
 	// pos in world frame
 	virtual void create(const btVector3& pos, float scale = 1.f) = 0;
+	// elapsed_time is in simulated seconds
 	virtual void update(float elapsed_time) = 0;
 	virtual void process_player_input(Controller& ctlr) = 0;
 	virtual const btRigidBody& body() = 0;
+	// called during the simulation step for the bodies watched by this actor
+	virtual void on_impact(btCollisionObject* body, const btCollisionObject* other) {}
+	// called after the simulation step to move the visual shapes
+	virtual void update_visuals() {}
 };
 
 class Vehicle : public Actor
@@ -58,17 +101,23 @@ protected:
 	btHingeConstraint* m_body_hinge; // hinge between gun body and base
 	btHingeConstraint* m_base_hinge; // hinge_between top and bottom bases
 	float m_barrel_radius;
-	btRigidBody* m_shell;
 	btVector3 m_mozzle;
-	float m_time_since_last_shot;
 	int m_max_bullets;
-	std::vector<btRigidBody*> m_bullets;
+	int m_row; // in the gun table of the world, with the shot timer and the projectiles
 	int m_projectile_texture;
+	// every projectile is a copy so the meshes and the template key are made once
+	SphereShape* m_bullet_shape;
+	CapsuleShape* m_shell_shape;
 	
 	virtual btRigidBody* get_connecting_body() { return m_bottom_base; }
 	virtual btVector3 get_connecting_point();
 
 	virtual bool is_ready() { return m_body != NULL; }
+	// projectiles do not hit each other nor the vehicles of the same team
+	int projectile_mask() {
+		int mask = PhysicsWorld::AllGroups & ~PhysicsWorld::ProjectileGroup;
+		return m_team < 0 ? mask : mask & ~(PhysicsWorld::TeamGroup << m_team);
+	}
 	void fire_bullet();
 	void fire_shell();
 
@@ -79,12 +128,14 @@ public:
 		Shell
 	};
 	Gun(PhysicsWorld& world);
-	virtual ~Gun() {}
+	virtual ~Gun() { m_world.get_guns().erase(m_row); delete m_bullet_shape; delete m_shell_shape; }
 
 	virtual void create(const btVector3& pos, float scale = 1.f);
-	virtual void update(float elapsed_time);
+	// the world updates all the guns at once, see gun_table
+	virtual void update(float elapsed_time) {}
 	virtual void process_player_input(Controller& ctlr);
 	virtual const btRigidBody& body() { return *m_body; }
+	virtual void on_impact(btCollisionObject* body, const btCollisionObject*) { m_world.get_guns().impacts.push_back(body); }
 	
 	void aim(float yaw_delta, float pitch_delta);
 	void fire(int ammo_type = Bullet);
@@ -135,16 +186,60 @@ public:
 	virtual const btRigidBody& body() { return *m_car_body; }
 };
 
+// track links that are only drawn, they run around the front and the back 
+// gears and are moved by the distance the track has travelled
+// The links are either one shape each or one shape for the whole track. The 
+// link pattern repeats every pitch so the whole track is laid out at a few 
+// phases along the pitch, it is swapped for the next phase as it moves.
+class TrackLinks
+{
+protected:
+	PhysicsWorld& m_world;
+	std::vector<int> m_links; // visual shape ids
+	std::vector<CompoundShape> m_phases; // the whole track at each phase
+	int m_phase;
+	int m_track;			  // visual shape id of the whole track
+	btVector3 m_center;		  // between the gear centers in the vehicle frame
+	float m_gear_pos;		  // distance from the center to the gear centers
+	float m_radius;			  // of the path around the gears
+	float m_length;			  // of the path
+	float m_pitch;			  // distance between two links along the path
+	float m_travel;
+
+	// at distance s along the path in the vehicle frame, the 
+	// path starts at the top of the back gear going forward
+	btTransform link_transform(float s);
+
+public:
+	TrackLinks(PhysicsWorld& world) : m_world(world), m_phase(0), m_track(-1), m_center(0.f, 0.f, 0.f), 
+		m_gear_pos(0.f), m_radius(0.f), m_length(0.f), m_pitch(0.f), m_travel(0.f) {}
+
+	// one shape per link unless phases is given
+	void create(const btTransform& vehicle, const btVector3& center, float gear_pos, float radius, 
+		float link_half_width, float link_half_length, float pitch, int texture, int phases = 0);
+	// distance is how far the top of the track moved forward since the last update
+	void update(const btTransform& vehicle, float distance);
+};
+
 class Tank : public Vehicle
 {
 protected:
 	Gun m_gun;
 	btRigidBody* m_tank_body;
 	btRigidBody* m_gear[4];
+	btHingeConstraint* m_gear_hinge[4];
+
+	// the tracks are either rigid bodies hinged to each other or only drawn, 
+	// then the tank rolls on its gears and the tracks follow the gear rotation
+	bool m_animated_tracks;
+	TrackLinks m_tracks[2];	// left and right
+	float m_gear_angle[4];	// hinge angles at the last update
+	float m_track_radius;
 	
 	float m_max_velocity;
-	int m_max_update;
-	int m_update;
+	// the gears are let go after an input and held firmly again over this time
+	float m_hold_time;
+	float m_hold; // time left until fully held
 
 	virtual btRigidBody* get_connecting_body() { return m_tank_body; }
 	virtual btVector3 get_connecting_point() { return btVector3(0.f, 0.75f, -1.f); }
@@ -152,7 +247,7 @@ protected:
 	virtual bool is_ready() { return false; }
 
 public:
-	Tank(PhysicsWorld& world);
+	Tank(PhysicsWorld& world, bool animated_tracks = false);
 	virtual ~Tank() {}
 
 	// control interface
@@ -166,6 +261,102 @@ public:
 	virtual void create(const btVector3& pos, float scale = 1.f);
 	virtual void update(float elapsed_time);
 	virtual void process_player_input(Controller& ctlr);
+	virtual void update_visuals();
 
 	virtual const btRigidBody& body() { return *m_tank_body; }
 };
+
+// A vehicle whose wheels are rays cast from the chassis instead of rigid bodies 
+// held by hinges, the wheels, gears and tracks are only drawn. It costs one rigid 
+// body (and the gun) in the solver.
+class RaycastVehicle : public Vehicle
+{
+protected:
+	Gun m_gun;
+	btRigidBody* m_chassis;
+	btRaycastVehicle* m_vehicle;
+	btRaycastVehicle::btVehicleTuning m_tuning;
+	std::vector<int> m_wheel_shapes; // visual shape id of each wheel, -1 if not drawn
+	btVector3 m_connecting_point;
+
+	// the inputs of this simulation step are in a row of the table of the 
+	// vehicle type, the world applies them to all the vehicles of the type 
+	// at once and skips the parked ones since the wheels keep the last inputs
+	raycast_vehicle_table& m_inputs;
+	int m_row;
+	float& engine_force() { return m_inputs.vehicles.get<1>(m_row); }
+	float& brake_force() { return m_inputs.vehicles.get<2>(m_row); }
+	float& steering() { return m_inputs.vehicles.get<3>(m_row); } // radians
+	void drive() { m_inputs.vehicles.get<4>(m_row) = raycast_vehicle_table::driven; }
+
+	virtual btRigidBody* get_connecting_body() { return m_chassis; }
+	virtual btVector3 get_connecting_point() { return m_connecting_point; }
+	virtual bool is_ready() { return m_vehicle != NULL; }
+
+	void create_chassis(const Shape& shape, const btVector3& pos, float mass);
+	// connection is the top of the suspension in the chassis frame
+	void add_wheel(const btVector3& connection, float suspension_length, float radius, bool front, Shape* shape);
+	btTransform get_chassis_transform();
+	// the transform of the wheel shape, its axis is along the axle
+	btTransform get_wheel_transform(int i);
+	// the vehicle action is removed while hibernating
+	virtual void hibernate();
+	virtual void wake();
+
+public:
+	RaycastVehicle(PhysicsWorld& world, raycast_vehicle_table& inputs);
+	virtual ~RaycastVehicle() { m_inputs.vehicles.erase(m_row); }
+
+	// only checks for hibernation, the inputs are applied by the world
+	virtual void update(float elapsed_time) {}
+	virtual void update_visuals();
+	virtual void process_player_input(Controller& ctlr);
+	virtual const btRigidBody& body() { return *m_chassis; }
+
+	// control interface
+	virtual void accelarate(float torque = 5.f) { engine_force() = torque * 40.f; drive(); }
+	virtual void brake() { brake_force() = 20.f; drive(); }
+};
+
+class RaycastCar : public RaycastVehicle
+{
+public:
+	RaycastCar(PhysicsWorld& world) : RaycastVehicle(world, world.get_raycast_cars()) {}
+	virtual ~RaycastCar() {}
+
+	virtual void create(const btVector3& pos, float scale = 1.f);
+
+	// control interface
+	virtual void turn(float degrees);
+	virtual void steer_left() { turn(1.f); }
+	virtual void steer_right() { turn(-1.f); }
+	virtual void steer_center() { steering() = 0.f; drive(); }
+};
+
+class RaycastTank : public RaycastVehicle
+{
+protected:
+	TrackLinks m_tracks[2];		// left and right
+	int m_gear_shapes[4];		// drawn, not simulated
+	btVector3 m_gear_origin[4]; // in the chassis frame
+	float m_gear_radius;
+	float m_wheel_radius;
+	float m_wheel_rotation[2]; // of each side at the last update
+	float m_gear_angle[2];
+
+	btTransform get_gear_transform(int i);
+
+public:
+	RaycastTank(PhysicsWorld& world);
+	virtual ~RaycastTank() {}
+
+	virtual void create(const btVector3& pos, float scale = 1.f);
+	virtual void update_visuals();
+
+	// control interface, the tank turns in place by steering 
+	// the front and back wheels the opposite ways
+	virtual void turn(float degrees) { steering() = glm::radians(degrees); drive(); }
+	virtual void steer_left() { turn(20.f); }
+	virtual void steer_right() { turn(-20.f); }
+	virtual void steer_center() { steering() = 0.f; drive(); }
+};
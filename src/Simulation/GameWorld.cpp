@@ -4,11 +4,14 @@
  * This software is licensed under the MIT License that can be 
  * found in the LICENSE file at the top of the source tree
  */
+#include <algorithm>
 #include <array>
+#include <cmath>
 #include <cstdio>
 #include <filesystem>
 #include <boost/json.hpp>
 #include "GameWorld.h"
+#include "../Utils.h"
 
 namespace json = boost::json;
 
@@ -19,8 +22,18 @@ protected:
 	json::object* m_root_obj; 
 
 	std::filesystem::path m_filename;
+	std::filesystem::path m_base_dir; // folder of m_filename
 	std::vector<JsonFile*> m_imports;
 
+	// relative pathnames in a json file are relative to the file itself
+	// resolve them here instead of changing the process-wide current path
+	// so multiple scenes can be loaded concurrently
+	std::filesystem::path resolve_path(const char* pathname) const {
+		std::filesystem::path path(pathname);
+		if (path.is_relative()) path = m_base_dir / path;
+		return path.lexically_normal();
+	}
+
 	json::value
 	parse_file(char const* filename)
 	{
@@ -52,10 +65,11 @@ public:
 	JsonFile(const char* filename) : 
 		m_root_obj(nullptr), m_filename(filename) {
 		if (m_filename.is_relative()) {
-			// make it absolute so we can set the current path 
-			// for subsequent path resolution
+			// make it absolute so the paths in this file 
+			// can be resolved against its own folder
 			m_filename = std::filesystem::absolute(m_filename);
 		}
+		m_base_dir = m_filename.parent_path();
 	}
 	virtual ~JsonFile() { 
 		for (auto& i : m_imports) {
@@ -70,13 +84,12 @@ public:
 
 		json::value* v = m_root_obj->if_contains("imports");
 		if (v && v->is_array()) {
-			// the import file paths are relative to the current folder
-			std::filesystem::path cwd = std::filesystem::current_path();
-			std::filesystem::current_path(m_filename.parent_path());
+			// the import file paths are relative to this file
 			for (const auto& i : v->get_array()) {
 				if (!i.is_string()) continue;
 
-				JsonFile* json = new JsonFile(i.get_string().c_str());
+				std::filesystem::path import_path = resolve_path(i.get_string().c_str());
+				JsonFile* json = new JsonFile(import_path.string().c_str());
 				if (json->parse()) {
 					m_imports.push_back(json);
 				} else {
@@ -84,7 +97,6 @@ public:
 					delete json;
 				}
 			}
-			std::filesystem::current_path(cwd);
 		}
 		return true;
 	}
@@ -92,6 +104,19 @@ public:
 	Shape* create_shape(GameWorld& world, const json::value* shape_obj);
 };
 
+// collision group by name, 0 if unknown
+// in a mask, "vehicle" also means the vehicles of all teams
+static int parse_collision_group(const json::value& name, bool in_mask = false)
+{
+	if (!name.is_string()) return 0;
+	const json::string& s = name.get_string();
+	if (s == "static") return PhysicsWorld::StaticGroup;
+	if (s == "object") return PhysicsWorld::ObjectGroup;
+	if (s == "vehicle") return in_mask ? PhysicsWorld::AnyVehicleGroup : PhysicsWorld::VehicleGroup;
+	if (s == "projectile") return PhysicsWorld::ProjectileGroup;
+	return 0;
+}
+
 Shape* JsonFile::create_shape(GameWorld& world, const json::value* shape_obj)
 {
 	if (shape_obj == nullptr) return nullptr;
@@ -151,38 +176,48 @@ Shape* JsonFile::create_shape(GameWorld& world, const json::value* shape_obj)
 	
 	Shape* shape = nullptr;
 	std::vector<float> dimension = std::move(value_to<std::vector<float>>(obj.at("dimension")));
-	if (kind == "ground") {
+	if (kind == "ground" && obj.contains("heightfield")) {
+		// 'file' is required for a height field, the samples are scaled by 'height'
+		const json::object& field = obj.at("heightfield").as_object();
+		std::filesystem::path path = resolve_path(field.at("file").get_string().c_str());
+		int columns, rows;
+		std::vector<float> heights;
+		if (!TextureMap::load_height_map(path.string().c_str(), columns, rows, heights)) return nullptr;
+		float height = field.contains("height") ? value_to<float>(field.at("height")) : 1.f;
+		for (float& h : heights) h *= height;
+		int chunk = field.contains("chunk") ? value_to<int>(field.at("chunk")) : 32;
+		shape = new HeightfieldShape(dimension[0], dimension[1], columns, rows, std::move(heights), std::max(chunk, 1), world.get_mesh_quality());
+	} else if (kind == "ground") {
 		shape = new GroundShape(dimension[0], dimension[1]);
 	} else if (kind == "box") {
 		shape = new BoxShape(dimension[0], dimension[1], dimension[2]);
 	} else if (kind == "sphere") {
-		shape = new SphereShape(dimension[0]);
+		shape = new SphereShape(dimension[0], world.get_mesh_quality());
 	} else if (kind == "cylinder") {
-		shape = new CylinderShape(dimension[0], dimension[1]);
+		shape = new CylinderShape(dimension[0], dimension[1], world.get_mesh_quality());
 	} else if (kind == "capsule") {
-		shape = new CapsuleShape(dimension[0], dimension[1]);
+		shape = new CapsuleShape(dimension[0], dimension[1], world.get_mesh_quality());
 	} else if (kind == "cone") {
-		shape = new ConeShape(dimension[0], dimension[1]);
+		shape = new ConeShape(dimension[0], dimension[1], world.get_mesh_quality());
 	} else if (kind == "pyramid") {
 		shape = new PyramidShape(dimension[0], dimension[1], dimension[2]);
 	} else if (kind == "wedge") {
 		shape = new WedgeShapeDesc(dimension[0], dimension[1], dimension[2], dimension[3]);
 	} else if (kind == "gear") {
-		shape = CreateGearShape(dimension[0], dimension[1], (int)dimension[2]);
+		shape = CreateGearShape(dimension[0], dimension[1], (int)dimension[2], 0.f, world.get_mesh_quality());
 	}
 	if (shape == nullptr) return nullptr;
 
 	if (obj.contains("textures")) {
-		// all texture file pathnames are relative to the current folder
-		std::filesystem::path cwd = std::filesystem::current_path();
-		std::filesystem::current_path(m_filename.parent_path());
+		// all texture file pathnames are relative to this file
 		TextureMap& txtr_map = world.get_texture_map();
 		for (const auto& t : obj.at("textures").as_array()) {
 			const json::object& txtr = t.as_object();
 
 			unsigned int texture = 0;
 			if (txtr.contains("file")) {
-				texture = txtr_map.from_file(txtr.at("file").get_string().c_str());
+				std::filesystem::path txtr_path = resolve_path(txtr.at("file").get_string().c_str());
+				texture = txtr_map.from_file(txtr_path.string().c_str());
 			} else if (txtr.contains("color")) {
 				texture = txtr_map.solid_color(txtr.at("color").get_string().c_str());
 			} else if (txtr.contains("checker_board")) {
@@ -210,12 +245,55 @@ Shape* JsonFile::create_shape(GameWorld& world, const json::value* shape_obj)
 			} else {
 				shape->add_texture(texture, repeat);
 			}
-			std::filesystem::current_path(cwd);
 		}
 	}
 	return shape;
 }
 
+// 'model' and 'tracks' are optional for the player and the bots
+static void parse_vehicle_model(const json::object& obj, bool& raycast, bool& animated_tracks)
+{
+	raycast = obj.contains("model") && obj.at("model").is_string() && 
+		obj.at("model").get_string() == "raycast";
+	animated_tracks = obj.contains("tracks") && obj.at("tracks").is_string() &&
+		obj.at("tracks").get_string() == "animated";
+}
+
+Actor* GameWorld::new_vehicle(std::string_view vehicle, bool raycast, bool animated_tracks)
+{
+	if (vehicle == "tank") {
+		return raycast ? (Actor*)new RaycastTank(*this) : new Tank(*this, animated_tracks);
+	} else if (vehicle == "V150") {
+		return raycast ? (Actor*)new RaycastCar(*this) : new Car(*this);
+	}
+	return NULL;
+}
+
+void GameWorld::add_bot(Actor* vehicle, const btVector3& pos, int team,
+						const std::vector<glm::vec3>& waypoints, size_t first, float fire_interval, bool can_pivot)
+{
+	vehicle->set_team(team);
+	vehicle->create(pos);
+	m_bots.push_back({ vehicle, Bot(fire_interval, can_pivot), Controller() });
+	Bot& bot = m_bots.back().bot;
+	if (waypoints.empty()) {
+		bot.set_loop(get_body_transform(vehicle->body()), 30.f);
+	} else {
+		bot.set_waypoints(waypoints, first);
+	}
+}
+
+void GameWorld::update_objects(float elapsed_time)
+{	// bots never go idle so their vehicles never hibernate, they count
+	// seconds of real time as the remote bots do
+	for (bot_driver& b : m_bots) {
+		b.bot.drive(get_body_transform(b.vehicle->body()), elapsed_time / m_time_scale, b.ctlr);
+		if (b.ctlr.has_input()) b.vehicle->on_input();
+		b.vehicle->process_player_input(b.ctlr);
+	}
+	PhysicsWorld::update_objects(elapsed_time);
+}
+
 bool GameWorld::create_scene_from_file(const char* filename)
 {
 	try
@@ -224,6 +302,11 @@ bool GameWorld::create_scene_from_file(const char* filename)
 		if (!json.parse()) return false;
 		if (!json.root_obj().contains("scene")) return false;
 
+		// 'mesh_quality' is optional, it applies to all the shapes of this scene and its vehicles
+		if (json.root_obj().contains("mesh_quality")) {
+			set_mesh_quality(value_to<float>(json.root_obj().at("mesh_quality")));
+		}
+
 		// "scene" is an array of shape descriptors 
 		for (const auto obj : json.root_obj().at("scene").as_array()) {
 			// a shape descriptor is an object
@@ -243,9 +326,18 @@ bool GameWorld::create_scene_from_file(const char* filename)
 			}	
 			// 'mass' is optional
 			float mass = shape_desc.contains("mass") ? value_to<float>(shape_desc.at("mass")) : 0.f; 
+			// 'collision_group' and 'collides_with' are optional
+			int group = shape_desc.contains("collision_group") ? parse_collision_group(shape_desc.at("collision_group")) : 0;
+			int mask = AllGroups;
+			if (shape_desc.contains("collides_with") && shape_desc.at("collides_with").is_array()) {
+				mask = 0;
+				for (const auto& g : shape_desc.at("collides_with").get_array()) {
+					mask |= parse_collision_group(g, true);
+				}
+			}
 			createRigidBody(*shape,
 							btVector3(origin[0], origin[1], origin[2]),
-							rotation, mass);
+							rotation, mass, group, mask);
 		}
 
 		// player has to be processed before camera so we know if camera can and should follow the player
@@ -254,12 +346,54 @@ bool GameWorld::create_scene_from_file(const char* filename)
 			if (player.contains("vehicle") && player.contains("origin")) {
 				std::vector<float> origin = std::move(value_to<std::vector<float>>(player.at("origin")));
 				const json::string vehicle = player.at("vehicle").as_string();
-				if (vehicle == "tank") {
-					add_tank(btVector3(origin[0], origin[1], origin[2]));
-				} else if (vehicle == "V150") {
-					add_v150(btVector3(origin[0], origin[1], origin[2]));
+				// 'team' is optional
+				int team = player.contains("team") ? value_to<int>(player.at("team")) : -1;
+				bool raycast, animated_tracks;
+				parse_vehicle_model(player, raycast, animated_tracks);
+				Actor* actor = new_vehicle(vehicle.c_str(), raycast, animated_tracks);
+				if (actor != NULL) add_actor(actor, btVector3(origin[0], origin[1], origin[2]), team);
+			}
+		}
+
+		// bots come after the player so the player is always player 0
+		if (json.root_obj().contains("bots")) {
+			const auto& bots = json.root_obj().at("bots").as_object();
+			int count = bots.contains("count") ? value_to<int>(bots.at("count")) : 0;
+			// 'vehicle' is optional
+			std::string vehicle = bots.contains("vehicle") ? bots.at("vehicle").as_string().c_str() : "tank";
+			// 'origin' and 'spacing' are optional, the bots are lined up in a square grid
+			std::vector<float> origin = { 0.f, 1.5f, 0.f };
+			if (bots.contains("origin")) origin = std::move(value_to<std::vector<float>>(bots.at("origin")));
+			float spacing = bots.contains("spacing") ? value_to<float>(bots.at("spacing")) : 15.f;
+			// 'team' is optional
+			int team = bots.contains("team") ? value_to<int>(bots.at("team")) : -1;
+			// 'fire_interval' is optional, 0 to hold fire
+			float fire_interval = bots.contains("fire_interval") ? value_to<float>(bots.at("fire_interval")) : 2.f;
+			// 'waypoints' is optional, bot i heads to waypoint i first
+			std::vector<glm::vec3> waypoints;
+			if (bots.contains("waypoints")) {
+				for (const auto& w : bots.at("waypoints").as_array()) {
+					std::vector<float> p = std::move(value_to<std::vector<float>>(w));
+					waypoints.push_back(glm::vec3(p[0], p[1], p[2]));
+				}
+			}
+			// 'remote' is optional, remote bots are players driven by swarm clients
+			bool remote = bots.contains("remote") && bots.at("remote").as_bool();
+			bool raycast, animated_tracks;
+			parse_vehicle_model(bots, raycast, animated_tracks);
+
+			int columns = (int)std::ceil(std::sqrt((float)count));
+			for (int i = 0; i < count; i++) {
+				Actor* actor = new_vehicle(vehicle, raycast, animated_tracks);
+				if (actor == NULL) break;
+				btVector3 pos(origin[0] + (i % columns) * spacing, origin[1], origin[2] + (i / columns) * spacing);
+				if (remote) {
+					add_actor(actor, pos, team);
+				} else {
+					add_bot(actor, pos, team, waypoints, i, fire_interval, vehicle == "tank");
 				}
 			}
+			debug_log("%d %s bots\n", count, remote ? "remote" : "server");
 		}
 
 		if (json.root_obj().contains("camera")) {
@@ -288,6 +422,9 @@ bool GameWorld::create_scene_from_file(const char* filename)
 				}
 			}
 		}
+		// all textures requested by the scene and the actors
+		// are decoded and generated in parallel
+		get_texture_map().build();
 	} catch (std::exception const& e) {
 		std::string msg = "failed to create scene: ";
 		msg += e.what();
@@ -6,8 +6,10 @@
  */
 #pragma once
 
+#include <string_view>
 #include "PhysicsWorld.h"
 #include "Actors.h" 
+#include "../Interface/Bot.h"
 
 class GameWorld : public PhysicsWorld
 {
@@ -16,19 +18,38 @@ protected:
 	btVector3 m_camera_pos, m_camera_target;
 	bool m_camera_follow_player;
 
-	void add_actor(Actor* actor, const btVector3& pos) { 
+	// vehicles driven on the server, they are not players
+	struct bot_driver
+	{
+		Actor* vehicle;
+		Bot bot;
+		Controller ctlr;
+	};
+	std::vector<bot_driver> m_bots;
+
+	void add_actor(Actor* actor, const btVector3& pos, int team) { 
+		actor->set_team(team);
 		actor->create(pos);
 		m_actors.push_back(actor); 
 	}
+	// NULL if the vehicle is unknown
+	Actor* new_vehicle(std::string_view vehicle, bool raycast, bool animated_tracks);
+
+	// the bots press their keys before the actors are updated
+	virtual void update_objects(float elapsed_time);
 
 public:
 	GameWorld() : m_camera_pos(0.f, 0.f, 0.f), 
 		m_camera_target(0.f, 0.f, 1.f), m_camera_follow_player(false) {}
 	virtual ~GameWorld() {
 		for (auto& actor : m_actors) delete actor;
+		for (auto& b : m_bots) delete b.vehicle;
 	}
 	virtual int how_many_players() { return (int)m_actors.size(); }
-	virtual void process_player_input(int which, Controller& ctlr) { m_actors[which]->process_player_input(ctlr); }
+	virtual void process_player_input(int which, Controller& ctlr) { 
+		if (ctlr.has_input()) m_actors[which]->on_input();
+		m_actors[which]->process_player_input(ctlr); 
+	}
 	virtual const btRigidBody& get_player_body(int which) { return m_actors[which]->body(); }
 
 	const btVector3& get_camera_pos() { return m_camera_pos; }
@@ -36,6 +57,17 @@ public:
 	bool should_camera_follow_player() { return m_camera_follow_player && how_many_players() > 0; }
 	
 	bool create_scene_from_file(const char* filename);
-	void add_tank(const btVector3& pos) { add_actor(new Tank(*this), pos); }
-	void add_v150(const btVector3& pos) { add_actor(new Car(*this), pos); }
+	// a raycast vehicle costs one rigid body instead of one for every wheel and track link,
+	// a tank with animated tracks keeps its gears but no track link bodies
+	void add_tank(const btVector3& pos, int team = -1, bool raycast = false, bool animated_tracks = false) {
+		add_actor(new_vehicle("tank", raycast, animated_tracks), pos, team);
+	}
+	void add_v150(const btVector3& pos, int team = -1, bool raycast = false) { 
+		add_actor(new_vehicle("V150", raycast, false), pos, team);
+	}
+	// the bot heads to waypoint 'first' first, without waypoints it loops to the left from where it starts,
+	// only a bot that can pivot turns in place
+	void add_bot(Actor* vehicle, const btVector3& pos, int team, 
+				 const std::vector<glm::vec3>& waypoints, size_t first, float fire_interval, bool can_pivot);
+	int how_many_bots() { return (int)m_bots.size(); }
 };
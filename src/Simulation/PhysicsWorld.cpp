@@ -5,12 +5,13 @@
  * found in the LICENSE file at the top of the source tree
  */
 #include <chrono>
+#include <BulletCollision/CollisionShapes/btHeightfieldTerrainShape.h>
 #include "PhysicsWorld.h"
 #include "Actors.h"
 #include "../Interface/Shapes.h"
 #include "../Utils.h"
 
-PhysicsWorld::PhysicsWorld()
+PhysicsWorld::PhysicsWorld() : m_update_budget(4), m_next_actor(0), m_hibernate_time(30.f), m_time_scale(3.f), m_mesh_quality(1.f)
 {	
 	collisionConfiguration = new btDefaultCollisionConfiguration();
 	dispatcher = new btCollisionDispatcher(collisionConfiguration);
@@ -18,6 +19,7 @@ PhysicsWorld::PhysicsWorld()
 	solver = new btSequentialImpulseConstraintSolver;
 	dynamicsWorld = new btDiscreteDynamicsWorld(dispatcher, overlappingPairCache, solver, collisionConfiguration);
 	dynamicsWorld->setGravity(btVector3(0.f, -10.f, 0.f));
+	dynamicsWorld->setInternalTickCallback(tick_callback, this);
 }
 
 PhysicsWorld::~PhysicsWorld()
@@ -50,6 +52,22 @@ btCollisionShape* create_collision_shape(const Shape& shape)
 		case Shape::Type::Ground:
 			collision_shape = new btStaticPlaneShape(btVector3(0.f, 1.f, 0.f), 0);
 		break;
+		case Shape::Type::Heightfield:
+		{	// the heights are not copied, the shape keeps them
+			const HeightfieldShape& field = dynamic_cast<const HeightfieldShape&>(shape);
+			btHeightfieldTerrainShape* terrain = new btHeightfieldTerrainShape(field.columns(), field.rows(),
+				field.heights().data(), 1.f, field.min_height(), field.max_height(), 1, PHY_FLOAT, false);
+			terrain->setLocalScaling(btVector3(shape.param()[0] / (field.columns() - 1), 1.f, 
+											   shape.param()[1] / (field.rows() - 1)));
+			// the terrain is centered between its lowest and highest points
+			// so it is moved for a height of 0 to be at the origin
+			btCompoundShape* compound = new btCompoundShape();
+			btTransform trans(btQuaternion(0.f, 0.f, 0.f, 1.f), 
+							  btVector3(0.f, (field.min_height() + field.max_height()) * .5f, 0.f));
+			compound->addChildShape(trans, terrain);
+			collision_shape = compound;
+		}
+		break;
 		case Shape::Type::Box:
 			collision_shape = new btBoxShape(btVector3(shape.param()[0], shape.param()[1], shape.param()[2]));
 		break;
@@ -82,7 +100,7 @@ btCollisionShape* create_collision_shape(const Shape& shape)
 }
 
 btRigidBody* PhysicsWorld::createRigidBody(const Shape& shape,
-	btVector3 origin, btQuaternion rotation, btScalar mass)
+	btVector3 origin, btQuaternion rotation, btScalar mass, int group, int mask)
 {
 	btCollisionShape* collision_shape = create_collision_shape(shape);
 	collisionShapes.push_back(collision_shape);
@@ -98,7 +116,10 @@ btRigidBody* PhysicsWorld::createRigidBody(const Shape& shape,
 	btDefaultMotionState* myMotionState = new btDefaultMotionState(trans);
 	btRigidBody::btRigidBodyConstructionInfo rbInfo(mass, myMotionState, collision_shape, localInertia);
 	btRigidBody* body = new btRigidBody(rbInfo);
-	dynamicsWorld->addRigidBody(body);
+	if (group == 0) group = (mass != 0.f) ? ObjectGroup : StaticGroup;
+	// static bodies never need to be tested against each other
+	if (group == StaticGroup) mask &= ~StaticGroup;
+	dynamicsWorld->addRigidBody(body, group, mask);
 	
 	glm::mat4 m;
 	trans.getOpenGLMatrix(&m[0][0]);
@@ -107,10 +128,29 @@ btRigidBody* PhysicsWorld::createRigidBody(const Shape& shape,
 	return body;
 }
 
+btRaycastVehicle* PhysicsWorld::createRaycastVehicle(btRigidBody* chassis, const btRaycastVehicle::btVehicleTuning& tuning)
+{
+	btVehicleRaycaster* raycaster = new btDefaultVehicleRaycaster(dynamicsWorld);
+	btRaycastVehicle* vehicle = new btRaycastVehicle(tuning, chassis, raycaster);
+	// right: x, up: y, forward: z
+	vehicle->setCoordinateSystem(0, 1, 2);
+	// the wheels stop casting rays when the chassis is deactivated
+	chassis->setActivationState(DISABLE_DEACTIVATION);
+	dynamicsWorld->addVehicle(vehicle);
+	return vehicle;
+}
+
 void PhysicsWorld::removeRigidBody(btRigidBody* body)
 {
-	int id = body->getCollisionShape()->getUserIndex();
-	m_observer.remove_shape(id);
+	btCollisionShape* collision_shape = body->getCollisionShape();
+	m_observer.remove_shape(collision_shape->getUserIndex());
+
+	// its contact manifolds are removed with it
+	dynamicsWorld->removeRigidBody(body);
+	delete body->getMotionState();
+	delete body;
+	collisionShapes.remove(collision_shape);
+	delete collision_shape;
 }
 
 void PhysicsWorld::teardown()
@@ -150,6 +190,8 @@ void PhysicsWorld::update_scene()
 	for (int j = dynamicsWorld->getNumCollisionObjects() - 1; j >= 0; j--)
 	{
 		btCollisionObject* obj = dynamicsWorld->getCollisionObjectArray()[j];
+		// Bullet does not move sleeping bodies either
+		if (obj->getActivationState() == ISLAND_SLEEPING) continue;
 		btRigidBody* body = btRigidBody::upcast(obj);
 		btTransform trans;
 		if (body && body->getMotionState()) {
@@ -167,12 +209,47 @@ void PhysicsWorld::update_scene()
 			m_observer.update_shape(id, model);
 		}
 	}
+	// the shapes that follow the bodies
+	for (Actor* actor : m_actors.column<0>()) {
+		if (!actor->is_hibernating()) actor->update_visuals();
+	}
 }
 
 void PhysicsWorld::update_objects(float elapsed_time)
-{	// called once for every simulation step
-	for (Actor* actor : m_actors) {
-		actor->update(elapsed_time);
+{	// called once for every simulation step, the actor types with a table first
+	m_guns.update(*this, elapsed_time);
+	apply_raycast_car_inputs(m_raycast_cars);
+	apply_raycast_tank_inputs(m_raycast_tanks);
+
+	std::vector<float>& interval = m_actors.column<1>();
+	std::vector<float>& since_update = m_actors.column<2>();
+	size_t n = m_actors.size();
+	size_t first = (m_next_actor < n) ? m_next_actor : 0;
+	bool deferred = false;
+	int budget = m_update_budget;
+	m_due.clear();
+	for (size_t k = 0; k < n; k++) {
+		size_t i = (first + k) % n;
+		since_update[i] += elapsed_time;
+		if (since_update[i] < interval[i]) continue;
+		if (interval[i] > 0.f && !m_actors.column<0>()[i]->is_hibernating()) {
+			if (budget == 0) {
+				if (!deferred) m_next_actor = i;
+				deferred = true;
+				continue;
+			}
+			budget -= 1;
+		}
+		m_due.push_back(m_actors.ids()[i]);
+	}
+
+	// by id after the scan since an update can add or remove actors
+	for (int id : m_due) {
+		int pos = m_actors.find(id);
+		if (pos < 0) continue;
+		float time = m_actors.column<2>()[pos];
+		m_actors.column<2>()[pos] = 0.f;
+		m_actors.column<0>()[pos]->run_update(time);
 	}
 }
 
@@ -197,8 +274,9 @@ int PhysicsWorld::run(const char* title)
 		// after processing inputs, update object and enviromental 
 		// states before the physics simulation
 		m_observer.begin_update();
-		update_objects(elapsed_time); // objects could be removed
-		dynamicsWorld->stepSimulation(elapsed_time * 3.f, 10);
+		float step_time = elapsed_time * m_time_scale;
+		update_objects(step_time); // objects could be removed
+		dynamicsWorld->stepSimulation(step_time, 10);
 		
 		for (int i = 0; i < n; i++) {
 			m_observer.set_player_transform(i, get_body_transform(get_player_body(i)));
@@ -211,22 +289,31 @@ int PhysicsWorld::run(const char* title)
 	return EXIT_SUCCESS;
 }
 
-bool PhysicsWorld::has_contact(btRigidBody* object)
+void PhysicsWorld::tick_callback(btDynamicsWorld* world, btScalar time_step)
 {
-	struct contact_callback : public btCollisionWorld::ContactResultCallback
-	{
-		int m_NumContacts;
-		contact_callback() { m_NumContacts = 0; }
+	static_cast<PhysicsWorld*>(world->getWorldUserInfo())->dispatch_impacts();
+}
 
-		virtual btScalar addSingleResult(btManifoldPoint& cp,
-										 const btCollisionObjectWrapper* colObj0Wrap, int partId0, int index0,
-										 const btCollisionObjectWrapper* colObj1Wrap, int partId1, int index1)
-		{
-			m_NumContacts += 1;
-			return 1.f; // not sure what this affects??
+void PhysicsWorld::dispatch_impacts()
+{	// the narrowphase has already computed the contact points of all 
+	// overlapping pairs, only the pairs with a watched body are of interest
+	int n = dispatcher->getNumManifolds();
+	for (int i = 0; i < n; i++) {
+		btPersistentManifold* manifold = dispatcher->getManifoldByIndexInternal(i);
+		const btCollisionObject* a = manifold->getBody0();
+		const btCollisionObject* b = manifold->getBody1();
+		Actor* actor_a = static_cast<Actor*>(a->getUserPointer());
+		Actor* actor_b = static_cast<Actor*>(b->getUserPointer());
+		if (actor_a == NULL && actor_b == NULL) continue;
+
+		bool touching = false;
+		for (int j = 0; j < manifold->getNumContacts() && !touching; j++) {
+			touching = manifold->getContactPoint(j).getDistance() <= 0.f;
 		}
-	};
-	contact_callback ccb;
-	dynamicsWorld->contactTest(object, ccb);
-	return ccb.m_NumContacts > 0;
+		if (!touching) continue;
+
+		// the bodies are only flagged here, they are removed by their actors in update()
+		if (actor_a) actor_a->on_impact(const_cast<btCollisionObject*>(a), b);
+		if (actor_b) actor_b->on_impact(const_cast<btCollisionObject*>(b), a);
+	}
 }
@@ -6,16 +6,33 @@
  */
 #pragma once
 
+#include <limits>
 #include <vector>
 #include <btBulletDynamicsCommon.h>
 #include "../Interface/SceneObserver.h"
+#include "../Interface/SlotMap.h"
+#include "ActorTables.h"
 
 class Actor;
 
 class PhysicsWorld
 {
 private:
-	std::vector<Actor*> m_actors;
+	// the scheduling state of the actors is kept in columns that are scanned 
+	// every step, only the actors that are due are called
+	slot_map<Actor*, float, float> m_actors; // update interval, time since update
+	std::vector<int> m_due; // ids of the actors due in this step
+	// the hot state of the actors of these types, updated in a batch every step
+	gun_table m_guns;
+	raycast_vehicle_table m_raycast_cars;
+	raycast_vehicle_table m_raycast_tanks;
+	// at most this many low priority actors are updated in a step, the ones
+	// left out are first in line in the next step, the hibernating ones only
+	// check for contacts and do not count
+	int m_update_budget;
+	size_t m_next_actor;
+	// simulated seconds without input before an actor at rest hibernates
+	float m_hibernate_time;
 
 protected:
 	btDefaultCollisionConfiguration* collisionConfiguration;
@@ -26,6 +43,8 @@ protected:
 	btAlignedObjectArray<btCollisionShape*> collisionShapes;
 
 	SceneObserver m_observer;
+	float m_time_scale; // simulated seconds per second
+	float m_mesh_quality; // of the curved shapes and the terrain of this scene
 
 	virtual void update_scene();
 
@@ -35,23 +54,74 @@ protected:
 	virtual void process_player_input(int which, Controller& ctlr) = 0;
 	virtual const btRigidBody& get_player_body(int which) = 0;
 
+	// elapsed_time is in simulated seconds
 	virtual void update_objects(float elapsed_time);
 	const glm::mat4 get_body_transform(const btRigidBody& body);
+
+	// impacts are found in the contact manifolds after every internal step
+	static void tick_callback(btDynamicsWorld* world, btScalar time_step);
+	void dispatch_impacts();
 	
 public:
+	// collision groups, the broadphase only pairs two bodies 
+	// if the group of each one is in the mask of the other
+	// object and static match Bullet's default filters used by ray and contact tests
+	enum
+	{
+		ObjectGroup = btBroadphaseProxy::DefaultFilter,
+		StaticGroup = btBroadphaseProxy::StaticFilter,
+		VehicleGroup = 4,
+		ProjectileGroup = 8,
+		TeamGroup = 16, // vehicles of team n are in (TeamGroup << n) instead of VehicleGroup
+		AllGroups = -1
+	};
+	static const int max_teams = 16;
+	// the vehicles in no team and in every team
+	static const int AnyVehicleGroup = VehicleGroup | (((1 << max_teams) - 1) * TeamGroup);
+
 	PhysicsWorld();
 	virtual ~PhysicsWorld();
 
 	virtual int how_many_players() = 0;
 	
 	int run(const char* title);
-	btRigidBody* createRigidBody(const Shape& shape, btVector3 origin, btQuaternion rotation, btScalar mass = 0.f);
+	// the group is StaticGroup or ObjectGroup by mass if not given
+	btRigidBody* createRigidBody(const Shape& shape, btVector3 origin, btQuaternion rotation, btScalar mass = 0.f,
+		int group = 0, int mask = AllGroups);
 	void removeRigidBody(btRigidBody* body);
 	void addConstraint(btTypedConstraint* constraint, bool disableCollisionsBetweenLinkedBodies = false) {
 		dynamicsWorld->addConstraint(constraint, disableCollisionsBetweenLinkedBodies);
 	}
-	void add_actor(Actor& actor) { m_actors.push_back(&actor); }
-	bool has_contact(btRigidBody* object);
+	// the wheels are rays cast from the chassis, add them before it is simulated
+	btRaycastVehicle* createRaycastVehicle(btRigidBody* chassis, const btRaycastVehicle::btVehicleTuning& tuning);
+	void removeRaycastVehicle(btRaycastVehicle* vehicle) { dynamicsWorld->removeVehicle(vehicle); }
+	void addRaycastVehicle(btRaycastVehicle* vehicle) { dynamicsWorld->addVehicle(vehicle); }
+	// shapes that are only drawn, their actors move them in Actor::update_visuals
+	int add_visual_shape(const Shape& shape, const glm::mat4& trans) { return m_observer.add_shape(&shape, trans); }
+	void move_visual_shape(int id, const glm::mat4& trans) { m_observer.update_shape(id, trans); }
+	void remove_visual_shape(int id) { m_observer.remove_shape(id); }
+	// returns the id of the actor in the schedule
+	int add_actor(Actor& actor) { return m_actors.insert(&actor, 0.f, 0.f); }
+	void remove_actor(int id) { m_actors.erase(id); }
+	// an actor with an interval is low priority, it is updated every interval
+	void set_update_interval(int id, float interval) { m_actors.get<1>(id) = interval; }
+	float get_update_interval(int id) { return m_actors.get<1>(id); }
+	float get_time_since_update(int id) { return m_actors.get<2>(id); }
+	// the actor is not updated until its interval is set again
+	void suspend_updates(int id) { m_actors.get<1>(id) = std::numeric_limits<float>::infinity(); }
+	// the actor is updated every interval from now on
+	void resume_updates(int id, float interval) { m_actors.get<1>(id) = interval; m_actors.get<2>(id) = 0.f; }
+	void set_update_budget(int max_low_priority_updates) { m_update_budget = max_low_priority_updates; }
+	void set_hibernate_time(float seconds) { m_hibernate_time = seconds; }
+	float get_hibernate_time() const { return m_hibernate_time; }
+	// higher quality makes finer meshes and keeps them until farther from the camera
+	void set_mesh_quality(float quality) { if (quality > 0.f) m_mesh_quality = quality; }
+	float get_mesh_quality() const { return m_mesh_quality; }
+	gun_table& get_guns() { return m_guns; }
+	raycast_vehicle_table& get_raycast_cars() { return m_raycast_cars; }
+	raycast_vehicle_table& get_raycast_tanks() { return m_raycast_tanks; }
+	// the actor is notified by Actor::on_impact when the body touches another object
+	void watch_impacts(btRigidBody* body, Actor& actor) { body->setUserPointer(&actor); }
 
 	// methods to interact with players and observers
 	TextureMap& get_texture_map() { return m_observer.get_texture_map(); }
@@ -4,27 +4,44 @@
  * This software is licensed under the MIT License that can be 
  * found in the LICENSE file at the top of the source tree
  */
+#include <filesystem>
+#include <thread>
 #include "Simulation/GameWorld.h"
 #include "Interface/OpenGLRenderer.h"
+#include "Interface/RenderThread.h"
 #include "PlayerProtocol.h"
+#include "LoadTest.h"
+
+std::filesystem::path texture_cache_dir()
+{	// decoded and generated textures are kept across runs
+	std::error_code ec;
+	std::filesystem::path dir = std::filesystem::temp_directory_path(ec);
+	return ec ? std::filesystem::path() : dir / "veh-sim" / "textures";
+}
 
 int run_local(const char* scene_pathname)
 {
 	GameWorld game;
+	game.get_texture_map().set_cache_dir(texture_cache_dir());
 	if (!game.create_scene_from_file(scene_pathname))
 		return 1;
 	
 	OpenGLRenderer renderer;
 	renderer.init("veh-sim");
+	// the simulation runs at a fixed rate on its own thread while this 
+	// thread, which owns the window and the OpenGL context, renders
+	RenderThread render_thread(renderer);
 	// players and observers can only join after the scene creation
 	// so all texture images can be sent to the local renderer
 	btVector3 eye = game.get_camera_pos();
 	btVector3 target = game.get_camera_target();
-	renderer.setup_camera(game.should_camera_follow_player(),
+	render_thread.setup_camera(game.should_camera_follow_player(),
 						  glm::vec3(eye.x(), eye.y(), eye.z()), 
 						  glm::vec3(target.x(), target.y(), target.z()));
-	game.get_scene_observer().connect(&renderer);
-	game.run("veh-sim");
+	game.get_scene_observer().connect(&render_thread);
+	std::thread simulation([&game]() { game.run("veh-sim"); });
+	render_thread.run();
+	simulation.join();
 	
 	renderer.teardown();
 	return 0;
@@ -35,6 +52,7 @@ int run_server(const std::string& server_opt, const char* scene_pathname)
 	try
 	{
 		GameWorld game;
+		game.get_texture_map().set_cache_dir(texture_cache_dir());
 		if (!game.create_scene_from_file(scene_pathname))
 			return 1;
 
@@ -77,6 +95,7 @@ int run_client(const std::string& server_opt)
 	try
 	{
 		PlayerClient player(renderer);
+		player.set_texture_cache_dir(texture_cache_dir());
 		size_t offset = server_opt.find_first_of(':');
 		std::string host = server_opt.substr(0, offset);
 		std::string port = server_opt.substr(offset + 1);
@@ -91,11 +110,22 @@ int run_client(const std::string& server_opt)
 	return 0;
 }
 
+int run_swarm(const std::string& server_opt, int count, float duration)
+{
+	size_t offset = server_opt.find_first_of(':');
+	std::string host = server_opt.substr(0, offset);
+	std::string port = server_opt.substr(offset + 1);
+	LoadTest test(host, port);
+	test.run(count, duration);
+	return 0;
+}
+
 int main(int argc, char *argv[])
 {	// program options:
 	// <path to scene file>
 	// server=<hostname>:<port> <path to scene file>
 	// client=<server>:<port>
+	// swarm=<server>:<port> <number of bots> [<seconds>]
 	if (argc == 2) {
 		std::string arg = argv[1];
 		const std::string client_opt = "join=";
@@ -114,10 +144,18 @@ int main(int argc, char *argv[])
 			} while(ret == 0);
 		}
 	}
+	if (argc == 3 || argc == 4) {
+		std::string arg = argv[1];
+		const std::string swarm_opt = "swarm=";
+		if (arg.starts_with(swarm_opt)) {
+			return run_swarm(arg.substr(swarm_opt.size()), std::stoi(argv[2]), argc == 4 ? std::stof(argv[3]) : 0.f);
+		}
+	}
 	// show usage:
 	printf("Usage:\n");
 	printf("Run locally: veh-sim <path to a scene json file>\n");
 	printf("Run as a game server: veh-sim server=<port number> <path to a scene json file>\n");
 	printf("Join a game server: veh-sim join=<server hostname or IPv4 address>:<port number>\n");
+	printf("Join a game server with bots: veh-sim swarm=<server hostname or IPv4 address>:<port number> <number of bots> [<seconds>]\n");
 	return 1;
 }
@@ -4,12 +4,46 @@
  * This software is licensed under the MIT License that can be 
  * found in the LICENSE file at the top of the source tree
  */
+const mat3 = glMatrix.mat3;
 const mat4 = glMatrix.mat4;
 const vec3 = glMatrix.vec3;
 
 const texture_map = new Map();
 const keyboard = new Set();
 const mouse = new Set();
+// textures are kept in IndexedDB by their content keys
+// so they are downloaded only once
+const texture_cache = new (class {
+  constructor() {
+    this.db = new Promise((resolve) => {
+      if (!window.indexedDB) {
+        resolve(null);
+        return;
+      }
+      const request = indexedDB.open("veh-sim", 1);
+      request.onupgradeneeded = () => { request.result.createObjectStore("textures"); };
+      request.onsuccess = () => { resolve(request.result); };
+      request.onerror = () => { resolve(null); }; // no caching
+    });
+  }
+
+  async get(key) {
+    const db = await this.db;
+    if (db === null) return undefined;
+    return new Promise((resolve) => {
+      const request = db.transaction("textures").objectStore("textures").get(key);
+      request.onsuccess = () => { resolve(request.result); };
+      request.onerror = () => { resolve(undefined); };
+    });
+  }
+
+  async put(key, image) {
+    const db = await this.db;
+    if (db === null) return;
+    db.transaction("textures", "readwrite").objectStore("textures").put(image, key);
+  }
+});
+
 const key_map = new Map([["Escape",256],["Enter",257],["ArrowRight",262],["ArrowLeft",263],
                         ["ArrowDown",264],["ArrowUp",265],["ShiftLeft",340],["ShiftRight",344]]);
 class Renderer 
@@ -19,6 +53,7 @@ class Renderer
     this.camera = camera;
     this.shaderProgram = this.initShaderProgram();
     this.gl.useProgram(this.shaderProgram);
+    this.template_map = new Map();
     this.shape_map = new Map();
   }
 
@@ -59,8 +94,9 @@ class Renderer
 
     const view = this.camera.get_view_matrix();
     gl.uniformMatrix4fv(gl.getUniformLocation(this.shaderProgram, "view"), false, new Float32Array(view));
+    const eye = this.camera.get_position();
     for (let shape of this.shape_map.values()) {
-      shape.draw(this.shaderProgram, shape.trans);
+      shape.template.draw(this.shaderProgram, shape.trans, eye);
     }
   }
 
@@ -76,8 +112,15 @@ class Renderer
     texture_map.set(id, txtr);
   }
 
-  add_shape(shape_id, descriptor) {
-    this.shape_map.set(shape_id, new Shape(this.gl, descriptor));
+  add_template(template_id, descriptor) {
+    this.template_map.set(template_id, new Shape(this.gl, descriptor));
+  }
+
+  add_shape(shape_id, template_id, trans) {
+    // shapes of the same kind share the template's buffers
+    if(this.template_map.has(template_id)) {
+      this.shape_map.set(shape_id, {"template": this.template_map.get(template_id), "trans": trans});
+    }
   }
 
   update_shape(shape_id, trans) {
@@ -106,12 +149,13 @@ class Renderer
       out vec2 txtr_pos;
 
       uniform mat4 model;
+      uniform mat3 normal_matrix;
       uniform mat4 view;
       uniform mat4 projection;
 
       void main()
       {
-        normal = mat3(transpose(inverse(model))) * n;
+        normal = normal_matrix * n;
         txtr_pos = t;
         gl_Position = projection * view * model * vec4(pos, 1.0);
       }    
@@ -167,6 +211,16 @@ class Renderer
   }
 }
 
+function normal_matrix(model) {
+  // computed once per draw instead of per vertex in the shader
+  // the transforms are mostly rigid (rotation and translation) where
+  // the inverse transpose of the rotation is the rotation itself
+  const m = mat3.fromMat4(mat3.create(), model);
+  const d = mat3.multiply(mat3.create(), mat3.transpose(mat3.create(), m), m);
+  if (mat3.equals(d, mat3.create())) return m;
+  return mat3.normalFromMat4(m, model);
+}
+
 class Shape
 {
   constructor(gl, d) {
@@ -183,42 +237,44 @@ class Shape
         this.child.push(new Shape(gl, s));
       }
       return;
-    } else {
-      // simple shape
-      this.mesh = d.mesh;
-      this.face_index = d.face_index;
-      this.textures = Object.hasOwn(d, "textures") ? d.textures : [];
     }
+    // simple shape with levels of detail from the finest to the coarsest
+    this.textures = Object.hasOwn(d, "textures") ? d.textures : [];
+    this.levels = [this.create_level(0, d.mesh, Object.hasOwn(d, "indices") ? d.indices : null, d.face_index)];
+    if (Object.hasOwn(d, "lods")) {
+      for (let l of d.lods) {
+        this.levels.push(this.create_level(l.distance, l.mesh, Object.hasOwn(l, "indices") ? l.indices : null, l.face_index));
+      }
+    }
+  }
 
+  create_level(distance, mesh, indices, face_index) {
     // setup shape vertices
-    this.vao = gl.createVertexArray();
-    gl.bindVertexArray(this.vao);
+    const gl = this.gl;
+    const level = {
+      "distance": distance, 
+      "indices": indices, 
+      "face_index": face_index,
+      "count": (indices !== null) ? indices.length : mesh.length / 5
+    };
+    level.vao = gl.createVertexArray();
+    gl.bindVertexArray(level.vao);
 
-    this.buffer = gl.createBuffer();
-    gl.bindBuffer(gl.ARRAY_BUFFER, this.buffer);
+    level.buffer = gl.createBuffer();
+    gl.bindBuffer(gl.ARRAY_BUFFER, level.buffer);
 
-    const mesh = this.mesh;
     const num_vertices = mesh.length / 5;
-    const normal = new Array();
-    for (let n = 0; n < num_vertices; n += 3) {
-      let i = n * 5;
-      //const mesh = shape.mesh;
-      const p1 = vec3.fromValues(mesh[i++], mesh[i++], mesh[i++]); i += 2;
-      const p2 = vec3.fromValues(mesh[i++], mesh[i++], mesh[i++]); i += 2;
-      const p3 = vec3.fromValues(mesh[i++], mesh[i++], mesh[i++]);
-
-      // one normal vector for each vertex!!!
-      const norm = vec3.create();
-      vec3.subtract(p2, p2, p1);
-      vec3.subtract(p3, p3, p1);
-      vec3.normalize(norm, vec3.cross(norm, p2, p3));
-      normal.push(norm[0], norm[1], norm[2]);
-      normal.push(norm[0], norm[1], norm[2]);
-      normal.push(norm[0], norm[1], norm[2]);
-    }
+    const normal = this.compute_normals(mesh, indices);
     gl.bufferData(gl.ARRAY_BUFFER, num_vertices * (5 + 3) * 4, gl.STATIC_DRAW);
-    gl.bufferSubData(gl.ARRAY_BUFFER, 0, new Float32Array(this.mesh));
-    gl.bufferSubData(gl.ARRAY_BUFFER, num_vertices * 5 * 4, new Float32Array(normal));
+    gl.bufferSubData(gl.ARRAY_BUFFER, 0, new Float32Array(mesh));
+    gl.bufferSubData(gl.ARRAY_BUFFER, num_vertices * 5 * 4, normal);
+
+    if (indices !== null) {
+      // the element buffer binding is part of the vertex array state
+      level.element_buffer = gl.createBuffer();
+      gl.bindBuffer(gl.ELEMENT_ARRAY_BUFFER, level.element_buffer);
+      gl.bufferData(gl.ELEMENT_ARRAY_BUFFER, indices, gl.STATIC_DRAW);
+    }
 
     // pos buffer (location = 0 in vertex shader)
     gl.vertexAttribPointer(0, 3, gl.FLOAT, false, 5 * 4, 0);
@@ -231,36 +287,82 @@ class Shape
     // normals (location = 2)
     gl.vertexAttribPointer(2, 3, gl.FLOAT, false, 3 * 4, num_vertices * 5 * 4);
     gl.enableVertexAttribArray(2);
+    return level;
+  }
+
+  compute_normals(mesh, indices) {
+    const num_vertices = mesh.length / 5;
+    const normal = new Float32Array(num_vertices * 3);
+    const p = (i) => vec3.fromValues(mesh[i * 5], mesh[i * 5 + 1], mesh[i * 5 + 2]);
+    const norm = vec3.create();
+    if (indices === null) {
+      // one (flat) normal vector for each vertex!!!
+      for (let n = 0; n < num_vertices; n += 3) {
+        const p1 = p(n), p2 = p(n + 1), p3 = p(n + 2);
+        vec3.subtract(p2, p2, p1);
+        vec3.subtract(p3, p3, p1);
+        vec3.normalize(norm, vec3.cross(norm, p2, p3));
+        for (let i = n; i < n + 3; i++) normal.set(norm, i * 3);
+      }
+      return normal;
+    }
+    // shared vertices get the (smooth) average of the triangle normals
+    for (let n = 0; n < indices.length; n += 3) {
+      const p1 = p(indices[n]), p2 = p(indices[n + 1]), p3 = p(indices[n + 2]);
+      vec3.subtract(p2, p2, p1);
+      vec3.subtract(p3, p3, p1);
+      vec3.cross(norm, p2, p3);
+      for (let i = n; i < n + 3; i++) {
+        const j = indices[i] * 3;
+        normal[j] += norm[0];
+        normal[j + 1] += norm[1];
+        normal[j + 2] += norm[2];
+      }
+    }
+    for (let j = 0; j < normal.length; j += 3) {
+      const v = vec3.fromValues(normal[j], normal[j + 1], normal[j + 2]);
+      if (vec3.length(v) == 0) v[1] = 1;
+      normal.set(vec3.normalize(v, v), j);
+    }
+    return normal;
   }
 
-  draw(shaderProgram, model) {
+  draw(shaderProgram, model, eye) {
+    // eye is the camera position to pick the level of detail
     const gl = this.gl;
     if (Object.hasOwn(this, 'child')) {
       for (let s of this.child) {
         const m = mat4.create();
         mat4.multiply(m, model, s.trans)
-        s.draw(shaderProgram, m);
+        s.draw(shaderProgram, m, eye);
       }    
     } 
     else 
-    { // draw a simple shape
+    { // draw a simple shape with the coarsest level within the distance from the camera
+      const distance = vec3.distance(eye, [model[12], model[13], model[14]]);
+      const level = this.levels.reduce((acc, cur) => (distance >= cur.distance) ? cur : acc);
+      const face_index = level.face_index;
       gl.uniformMatrix4fv(gl.getUniformLocation(shaderProgram, "model"), false, new Float32Array(model));
-      gl.bindVertexArray(this.vao);
-      const num_vertices = this.mesh.length / 5;
-      for (let i = 0; i < this.face_index.length; i++)
+      gl.uniformMatrix3fv(gl.getUniformLocation(shaderProgram, "normal_matrix"), false, normal_matrix(model));
+      gl.bindVertexArray(level.vao);
+      for (let i = 0; i < face_index.length; i++)
       {          
         if (!Object.hasOwn(this, "default_texture") && i >= this.textures.length) {
           // skip the face if no texture specified
           // no wire-frame drawing mode support in WebGL
           continue;
         }        
-        const index = this.face_index[i];
-        const n = (i == this.face_index.length - 1) ? num_vertices - index : this.face_index[i + 1] - index;
+        const index = face_index[i];
+        const n = (i == face_index.length - 1) ? level.count - index : face_index[i + 1] - index;
         const txtr = (i < this.textures.length) ? texture_map.get(this.textures[i]) : this.default_texture;
         gl.activeTexture(gl.TEXTURE0);
         gl.bindTexture(gl.TEXTURE_2D, txtr);    
         gl.uniform1i(gl.getUniformLocation(shaderProgram, "txtr"), 0);
-        gl.drawArrays(gl.TRIANGLES, index, n);
+        if (level.indices !== null) {
+          gl.drawElements(gl.TRIANGLES, n, gl.UNSIGNED_INT, index * 4);
+        } else {
+          gl.drawArrays(gl.TRIANGLES, index, n);
+        }
       }
     }
   }
@@ -282,6 +384,7 @@ const game_client = new (class {
         this.eye = vec3.create();
         this.target = vec3.create();
         this.trans = mat4.create();
+        this.pos = vec3.create();
         this.pos_buffer = new Array();
       }
 
@@ -296,13 +399,14 @@ const game_client = new (class {
       }
 
       get_stabilized_pos(pos) {
-        const n = 90;
-        if (this.pos_buffer.length >= n) {
+        // average of the positions of the past 1.5 second
+        const now = performance.now();
+        while (this.pos_buffer.length > 0 && this.pos_buffer[0].time < now - 1500) {
           // remove the oldest (first) position
           this.pos_buffer.shift();
         }
-        this.pos_buffer.push(pos);
-        const p = this.pos_buffer.reduce((acc, cur) => vec3.add(acc, cur, acc));
+        this.pos_buffer.push({ time: now, pos: pos });
+        const p = this.pos_buffer.reduce((acc, cur) => vec3.add(acc, acc, cur.pos), vec3.create());
         return vec3.scale(p, p, 1.0 / this.pos_buffer.length);
       }
 
@@ -316,8 +420,14 @@ const game_client = new (class {
         
         const m = mat4.create();
         mat4.lookAt(m, eye, target, [0, 1, 0]);
+        this.pos = eye;
         return m;
       }
+
+      get_position() {
+        // position of the camera in the last view matrix
+        return this.pos;
+      }
     });
 
     this.renderer = new Renderer(gl, this.camera);
@@ -391,12 +501,114 @@ const game_client = new (class {
     }  
   }
 
+  async add_textures(socket, textures) {
+    // use the cached textures and request the rest from the server
+    const missing = [];
+    for (let t of textures) {
+      const image = (t.key == "0000000000000000") ? undefined : await texture_cache.get(t.key);
+      if (image !== undefined && image.width == t.width && image.height == t.height) {
+        this.renderer.add_texture(t.id, t.width, t.height, image.data);
+      } else {
+        missing.push(t.id);
+      }
+    }
+    socket.send(JSON.stringify({"cmd": "request_textures", "ids": missing}));
+  }
+
+  parse_shape_desc(frame, offset) {
+    // a binary shape descriptor: header (num_children, num_vertices, num_indices, num_faces, 
+    // default_texture, num_textures, num_lods, trans) then mesh, indices, face_index, textures, 
+    // levels of detail and child shapes
+    const header = new DataView(frame, offset, 92);
+    const num_children = header.getUint32(0, true);
+    const num_vertices = header.getUint32(4, true);
+    const num_indices = header.getUint32(8, true);
+    const num_faces = header.getUint32(12, true);
+    const default_texture = header.getUint32(16, true);
+    const num_textures = header.getUint32(20, true);
+    const num_lods = header.getUint32(24, true);
+    const d = { "trans": new Float32Array(frame, offset + 28, 16) };
+    offset += 92;
+    if (num_children > 0) {
+      // compound shape
+      d.child = new Array();
+      for (let i = 0; i < num_children; i++) {
+        const c = this.parse_shape_desc(frame, offset);
+        d.child.push(c.desc);
+        offset = c.offset;
+      }
+      return { "desc": d, "offset": offset };
+    }
+    if (default_texture != 0) {
+      d.default_texture = default_texture;
+    }
+    d.mesh = new Float32Array(frame, offset, num_vertices * 5);
+    offset += num_vertices * 5 * 4;
+    if (num_indices > 0) {
+      d.indices = new Uint32Array(frame, offset, num_indices);
+    }
+    offset += num_indices * 4;
+    d.face_index = Array.from(new Int32Array(frame, offset, num_faces));
+    offset += num_faces * 4;
+    d.textures = Array.from(new Uint32Array(frame, offset, num_textures));
+    offset += num_textures * 4;
+    d.lods = new Array();
+    for (let i = 0; i < num_lods; i++) {
+      // a level of detail: header (distance, num_vertices, num_indices, num_faces) 
+      // then mesh, indices and face_index
+      const h = new DataView(frame, offset, 16);
+      const n = [h.getUint32(4, true), h.getUint32(8, true), h.getUint32(12, true)];
+      const l = { "distance": h.getFloat32(0, true) };
+      offset += 16;
+      l.mesh = new Float32Array(frame, offset, n[0] * 5);
+      offset += n[0] * 5 * 4;
+      if (n[1] > 0) {
+        l.indices = new Uint32Array(frame, offset, n[1]);
+      }
+      offset += n[1] * 4;
+      l.face_index = Array.from(new Int32Array(frame, offset, n[2]));
+      offset += n[2] * 4;
+      d.lods.push(l);
+    }
+    return { "desc": d, "offset": offset };
+  }
+
+  add_template(frame) {
+    // a binary template frame: header (magic, template_id) then the shape descriptor
+    const template_id = new DataView(frame, 4, 4).getInt32(0, true);
+    this.renderer.add_template(template_id, this.parse_shape_desc(frame, 8).desc);
+  }
+
+  add_texture(frame) {
+    // a binary texture frame: header (magic, id, width, height, key) then pixels
+    const header = new DataView(frame, 0, 24);
+    const id = header.getUint32(4, true);
+    const width = header.getUint32(8, true);
+    const height = header.getUint32(12, true);
+    const key = header.getBigUint64(16, true).toString(16).padStart(16, "0");
+    const image = new Uint8Array(frame, 24);
+    this.renderer.add_texture(id, width, height, image);
+    if (key != "0000000000000000") {
+      texture_cache.put(key, {"width": width, "height": height, "data": image});
+    }
+  }
+
   connect(url) {
     const socket = new WebSocket("ws://" + url);
+    socket.binaryType = "arraybuffer";
     socket.onerror = (event) => { alert("Failed to connect to game server @ " + url); }
     socket.onopen = (event) => {};  
     socket.onmessage = (event) => {
-      const n = event.data.length;
+      if (event.data instanceof ArrayBuffer) {
+        // binary messages are textures and shape templates
+        const magic = String.fromCharCode(...new Uint8Array(event.data, 0, 4));
+        if (magic == "VSTF") {
+          this.add_texture(event.data);
+        } else if (magic == "VSTM") {
+          this.add_template(event.data);
+        }
+        return;
+      }
       const msg = JSON.parse(event.data);
       switch (msg.cmd) {
         // initial setup messages
@@ -406,9 +618,8 @@ const game_client = new (class {
         case "setup_camera":
           this.camera.setup(msg.eye, msg.target, msg.follow);
           break;
-        case "add_texture":
-          const image = Uint8Array.from(atob(msg.data), (c) => c.charCodeAt(0));
-          this.renderer.add_texture(msg.id, msg.width, msg.height, image);
+        case "add_textures":
+          this.add_textures(socket, msg.textures);
           break;
         
         // messages in an update cycle
@@ -450,7 +661,7 @@ const game_client = new (class {
           }
           break;
         case "add_shape":
-          this.renderer.add_shape(msg.shape_id, msg.descriptor);
+          this.renderer.add_shape(msg.shape_id, msg.template_id, msg.trans);
           break;
         case "update_shape":
           this.renderer.update_shape(msg.shape_id, msg.trans);